@@ -10,6 +10,8 @@ expr
         | expr (MUL | DIV) expr  # BinaryOp
         | expr (ADD | SUB) expr  # BinaryOp
         | CELL  # Cell
+        | SHEET_CELL  # SheetCell
+        | REF  # Ref
         | NUMBER  # Literal
         ;
 
@@ -27,4 +29,7 @@ SUB: '-' ;
 MUL: '*' ;
 DIV: '/' ;
 CELL: [A-Z]+[0-9]+ ;
+SHEET_CELL: [a-zA-Z_][a-zA-Z0-9_]* '!' [A-Z]+[0-9]+ ;
+// a reference to a deleted cell
+REF: '#REF!' ;
 WS: [ \t\n\r]+ -> skip ;
\ No newline at end of file
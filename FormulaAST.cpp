@@ -4,9 +4,13 @@
 #include "FormulaLexer.h"
 #include "FormulaParser.h"
 #include "common.h"
+#include "tracing.h"
 
 #include <cassert>
 #include <cmath>
+#include <iomanip>
+#include <iterator>
+#include <limits>
 #include <memory>
 #include <optional>
 #include <sstream>
@@ -68,6 +72,13 @@ constexpr PrecedenceRule PRECEDENCE_RULES[EP_END][EP_END] = {
     /* EP_ATOM */ {PR_NONE, PR_NONE, PR_NONE, PR_NONE, PR_NONE, PR_NONE},
 };
 
+// kinds of cell references found in a subtree
+enum ReferenceFlags {
+    REF_NONE = 0b00,
+    REF_LOCAL = 0b01,        // cells of the sheet the formula belongs to
+    REF_OTHER_SHEET = 0b10,  // cells of other sheets of the workbook
+};
+
 class Expr {
 public:
     virtual ~Expr() = default;
@@ -78,6 +89,21 @@ public:
     // higher is tighter
     virtual ExprPrecedence GetPrecedence() const = 0;
 
+    // bytes occupied by this node and its subtree
+    virtual size_t GetMemoryUsage() const = 0;
+
+    // ReferenceFlags of the subtree
+    virtual int GetReferenceFlags() const = 0;
+
+    // replaces shareable subtrees below this node with shared ones
+    virtual void ShareChildren(SharedSubexpressions& /* pool */) {
+    }
+
+    // moves the positions referenced by the subtree into storage, so that
+    // the subtree no longer points into the cell list of its formula
+    virtual void RebindCells(std::forward_list<Position>& /* storage */) {
+    }
+
     void PrintFormula(std::ostream& out, ExprPrecedence parent_precedence,
                       bool right_child = false) const {
         auto precedence = GetPrecedence();
@@ -95,6 +121,10 @@ public:
     }
 };
 
+// shares the children of expr and then expr itself, if it is an operation
+// on cells of the sheet only
+void ShareSubtree(std::unique_ptr<Expr>& expr, SharedSubexpressions& pool);
+
 namespace {
 class BinaryOpExpr final : public Expr {
 public:
@@ -175,6 +205,24 @@ public:
       return result;
     }
 
+    size_t GetMemoryUsage() const override {
+        return sizeof(*this) + lhs_->GetMemoryUsage() + rhs_->GetMemoryUsage();
+    }
+
+    int GetReferenceFlags() const override {
+        return lhs_->GetReferenceFlags() | rhs_->GetReferenceFlags();
+    }
+
+    void ShareChildren(SharedSubexpressions& pool) override {
+        ShareSubtree(lhs_, pool);
+        ShareSubtree(rhs_, pool);
+    }
+
+    void RebindCells(std::forward_list<Position>& storage) override {
+        lhs_->RebindCells(storage);
+        rhs_->RebindCells(storage);
+    }
+
 private:
     Type type_;
     std::unique_ptr<Expr> lhs_;
@@ -217,11 +265,56 @@ public:
       return operand_value;
     }
 
+    size_t GetMemoryUsage() const override {
+        return sizeof(*this) + operand_->GetMemoryUsage();
+    }
+
+    int GetReferenceFlags() const override {
+        return operand_->GetReferenceFlags();
+    }
+
+    void ShareChildren(SharedSubexpressions& pool) override {
+        ShareSubtree(operand_, pool);
+    }
+
+    void RebindCells(std::forward_list<Position>& storage) override {
+        operand_->RebindCells(storage);
+    }
+
 private:
     Type type_;
     std::unique_ptr<Expr> operand_;
 };
 
+// numeric value of a referenced cell; an empty cell counts as zero
+double CellToNumber(const CellInterface* cell) {
+  if (cell == nullptr) {
+    return 0;
+  }
+
+  CellInterface::Value value = cell->GetValue();
+
+  if (std::holds_alternative<double>(value)) {
+    return std::get<double>(value);
+  } else if (std::holds_alternative<std::string>(value)) {
+    try {
+      std::string text = std::get<std::string>(value);
+      int number = std::stoi(text);
+      if (std::to_string(number) == text) {
+        return number;
+      } else {
+        throw FormulaError(FormulaError::Category::Value);
+      }
+    } catch (...) {
+      throw FormulaError(FormulaError::Category::Value);
+    }
+  } else if (std::holds_alternative<FormulaError>(value)) {
+    throw std::get<FormulaError>(value);
+  }
+
+  throw std::runtime_error("Uncnown cell value type");
+}
+
 class CellExpr final : public Expr {
 public:
     explicit CellExpr(const Position* cell)
@@ -230,7 +323,7 @@ public:
 
     void Print(std::ostream& out) const override {
         if (!cell_->IsValid()) {
-            out << FormulaError::Category::Ref;
+            out << FormulaError(FormulaError::Category::Ref);
         } else {
             out << cell_->ToString();
         }
@@ -245,38 +338,70 @@ public:
     }
 
     double Evaluate(const SheetInterface& sheet) const override {
+        // the referenced cell has been deleted
+        if (!cell_->IsValid()) {
+            throw FormulaError(FormulaError::Category::Ref);
+        }
+        return CellToNumber(sheet.GetCell(*cell_));
+    }
 
-      const CellInterface* cell = sheet.GetCell(*cell_);
+    size_t GetMemoryUsage() const override {
+        return sizeof(*this);
+    }
 
-      if (cell == nullptr) {
-        return 0;
-      }
+    int GetReferenceFlags() const override {
+        return REF_LOCAL;
+    }
 
-      CellInterface::Value value = cell->GetValue();
-
-      if (std::holds_alternative<double>(value)) {
-        return std::get<double>(value);
-      } else if (std::holds_alternative<std::string>(value)) {
-        try {
-          std::string text = std::get<std::string>(value);
-          int number = std::stoi(text);
-          if (std::to_string(number) == text) {
-            return number;
-          } else {
-            throw FormulaError(FormulaError::Category::Value);
-          }
-        } catch (...) {
-          throw FormulaError(FormulaError::Category::Value);
+    void RebindCells(std::forward_list<Position>& storage) override {
+        storage.push_front(*cell_);
+        cell_ = &storage.front();
+    }
+
+private:
+    const Position* cell_;
+};
+
+class SheetCellExpr final : public Expr {
+public:
+    explicit SheetCellExpr(const SheetPosition* cell)
+        : cell_(cell) {
+    }
+
+    void Print(std::ostream& out) const override {
+        if (!cell_->pos.IsValid()) {
+            out << FormulaError(FormulaError::Category::Ref);
+        } else {
+            out << cell_->ToString();
         }
-      } else if (std::holds_alternative<FormulaError>(value)) {
-        throw std::get<FormulaError>(value);
-      }
+    }
+
+    void DoPrintFormula(std::ostream& out, ExprPrecedence /* precedence */) const override {
+        Print(out);
+    }
+
+    ExprPrecedence GetPrecedence() const override {
+        return EP_ATOM;
+    }
 
-      throw std::runtime_error("Uncnown cell value type");
+    double Evaluate(const SheetInterface& sheet) const override {
+        const SheetInterface* other = sheet.FindSheet(cell_->sheet);
+        if (other == nullptr || !cell_->pos.IsValid()) {
+            throw FormulaError(FormulaError::Category::Ref);
+        }
+        return CellToNumber(other->GetCell(cell_->pos));
+    }
+
+    size_t GetMemoryUsage() const override {
+        return sizeof(*this);
+    }
+
+    int GetReferenceFlags() const override {
+        return REF_OTHER_SHEET;
     }
 
 private:
-    const Position* cell_;
+    const SheetPosition* cell_;
 };
 
 class NumberExpr final : public Expr {
@@ -301,9 +426,162 @@ public:
         return value_;
     }
 
+    size_t GetMemoryUsage() const override {
+        return sizeof(*this);
+    }
+
+    int GetReferenceFlags() const override {
+        return REF_NONE;
+    }
+
 private:
     double value_;
 };
+}  // namespace
+
+// a subtree shared by formulas of one sheet; its value is cached for the
+// current epoch of the pool. The node leaves the pool together with the
+// last formula that uses it.
+class SharedNode final : public std::enable_shared_from_this<SharedNode> {
+public:
+    SharedNode(std::unique_ptr<Expr> expr, std::string key, SharedSubexpressions& pool)
+        : expr_(std::move(expr))
+        , key_(std::move(key))
+        , pool_(&pool) {
+        expr_->RebindCells(cells_);
+    }
+
+    ~SharedNode() {
+        if (pool_) {
+            // after a rewrite other nodes may have the same key
+            auto [it, end] = pool_->nodes_.equal_range(key_);
+            while (it != end && it->second != this) {
+                ++it;
+            }
+            if (it != end) {
+                pool_->nodes_.erase(it);
+            }
+        }
+    }
+
+    static std::shared_ptr<SharedNode> Intern(std::unique_ptr<Expr> expr,
+                                              SharedSubexpressions& pool) {
+        std::string key = MakeKey(*expr);
+        auto it = pool.nodes_.find(key);
+        if (it != pool.nodes_.end()) {
+            return it->second->shared_from_this();
+        }
+        auto node = std::make_shared<SharedNode>(std::move(expr), std::move(key), pool);
+        pool.nodes_.emplace(node->key_, node.get());
+        return node;
+    }
+
+    const Expr& GetExpr() const {
+        return *expr_;
+    }
+
+    double Evaluate(const SheetInterface& sheet) const {
+        if (pool_ && value_ && epoch_ == pool_->epoch_) {
+            ++pool_->hits_;
+        } else {
+            try {
+                value_ = expr_->Evaluate(sheet);
+            } catch (const FormulaError& error) {
+                value_ = error;
+            }
+            epoch_ = pool_ ? pool_->epoch_ : 0;
+        }
+        if (const FormulaError* error = std::get_if<FormulaError>(&*value_)) {
+            throw *error;
+        }
+        return std::get<double>(*value_);
+    }
+
+    size_t GetMemoryUsage() const {
+        return sizeof(*this) + expr_->GetMemoryUsage() + key_.capacity() +
+               std::distance(cells_.begin(), cells_.end()) *
+                   (sizeof(void*) + sizeof(Position));
+    }
+
+    // changes the referenced positions in place and returns the new key
+    const std::string& RewriteCells(const std::function<Position(Position)>& rewrite) {
+        for (Position& cell : cells_) {
+            cell = rewrite(cell);
+        }
+        key_ = MakeKey(*expr_);
+        value_.reset();
+        return key_;
+    }
+
+    // called when the pool is destroyed before the formulas
+    void Detach() {
+        pool_ = nullptr;
+    }
+
+private:
+    // the printed subtree with numbers at full precision: at the default
+    // 6 digits 1.0000001 and 1.0000002 would share one node
+    static std::string MakeKey(const Expr& expr) {
+        std::ostringstream key;
+        key << std::setprecision(std::numeric_limits<double>::max_digits10);
+        expr.Print(key);
+        return key.str();
+    }
+
+    std::unique_ptr<Expr> expr_;
+    std::forward_list<Position> cells_;
+    std::string key_;
+    SharedSubexpressions* pool_;
+    mutable std::optional<FormulaInterface::Value> value_;
+    mutable uint64_t epoch_ = 0;
+};
+
+namespace {
+class SharedExpr final : public Expr {
+public:
+    explicit SharedExpr(std::shared_ptr<const SharedNode> node)
+        : node_(std::move(node)) {
+    }
+
+    void Print(std::ostream& out) const override {
+        node_->GetExpr().Print(out);
+    }
+
+    void DoPrintFormula(std::ostream& out, ExprPrecedence precedence) const override {
+        node_->GetExpr().DoPrintFormula(out, precedence);
+    }
+
+    ExprPrecedence GetPrecedence() const override {
+        return node_->GetExpr().GetPrecedence();
+    }
+
+    double Evaluate(const SheetInterface& sheet) const override {
+        return node_->Evaluate(sheet);
+    }
+
+    // the shared node is split evenly between the formulas using it
+    size_t GetMemoryUsage() const override {
+        return sizeof(*this) + node_->GetMemoryUsage() / node_.use_count();
+    }
+
+    int GetReferenceFlags() const override {
+        return node_->GetExpr().GetReferenceFlags();
+    }
+
+private:
+    std::shared_ptr<const SharedNode> node_;
+};
+}  // namespace
+
+void ShareSubtree(std::unique_ptr<Expr>& expr, SharedSubexpressions& pool) {
+    expr->ShareChildren(pool);
+    // a single cell or number is cheaper to evaluate than to look up
+    if (expr->GetPrecedence() != EP_ATOM && expr->GetReferenceFlags() == REF_LOCAL) {
+        expr = std::make_unique<SharedExpr>(SharedNode::Intern(std::move(expr), pool));
+    }
+}
+
+namespace {
 
 class ParseASTListener final : public FormulaBaseListener {
 public:
@@ -319,6 +597,10 @@ public:
         return std::move(cells_);
     }
 
+    std::forward_list<SheetPosition> MoveSheetCells() {
+        return std::move(sheet_cells_);
+    }
+
 public:
     void exitUnaryOp(FormulaParser::UnaryOpContext* ctx) override {
         assert(args_.size() >= 1);
@@ -362,6 +644,25 @@ public:
         args_.push_back(std::move(node));
     }
 
+    void exitSheetCell(FormulaParser::SheetCellContext* ctx) override {
+        auto value_str = ctx->SHEET_CELL()->getSymbol()->getText();
+        auto separator = value_str.find('!');
+        SheetPosition value{value_str.substr(0, separator),
+                            Position::FromString(value_str.substr(separator + 1))};
+        if (!value.pos.IsValid()) {
+            throw FormulaException("Invalid position: " + value_str);
+        }
+
+        sheet_cells_.push_front(std::move(value));
+        auto node = std::make_unique<SheetCellExpr>(&sheet_cells_.front());
+        args_.push_back(std::move(node));
+    }
+
+    void exitRef(FormulaParser::RefContext* /* ctx */) override {
+        // a deleted cell is not a reference, so it stays out of cells_
+        args_.push_back(std::make_unique<CellExpr>(&Position::NONE));
+    }
+
     void exitBinaryOp(FormulaParser::BinaryOpContext* ctx) override {
         assert(args_.size() >= 2);
 
@@ -393,6 +694,7 @@ public:
 private:
     std::vector<std::unique_ptr<Expr>> args_;
     std::forward_list<Position> cells_;
+    std::forward_list<SheetPosition> sheet_cells_;
 };
 
 class BailErrorListener : public antlr4::BaseErrorListener {
@@ -425,11 +727,19 @@ FormulaAST ParseFormulaAST(std::istream& in) {
     parser.setErrorHandler(error_handler);
     parser.removeErrorListeners();
 
-    tree::ParseTree* tree = parser.main();
+    tree::ParseTree* tree = nullptr;
+    {
+        TraceSpan span("FormulaParser::main");
+        tree = parser.main();
+    }
     ASTImpl::ParseASTListener listener;
-    tree::ParseTreeWalker::DEFAULT.walk(&listener, tree);
+    {
+        TraceSpan span("ParseASTListener::walk");
+        tree::ParseTreeWalker::DEFAULT.walk(&listener, tree);
+    }
 
-    return FormulaAST(listener.MoveRoot(), listener.MoveCells());
+    return FormulaAST(listener.MoveRoot(), listener.MoveCells(),
+                      listener.MoveSheetCells());
 }
 
 FormulaAST ParseFormulaAST(const std::string& in_str) {
@@ -452,13 +762,71 @@ void FormulaAST::PrintFormula(std::ostream& out) const {
 }
 
 double FormulaAST::Execute(const SheetInterface& sheet) const {
+    TraceSpan span("FormulaAST::Execute");
     return root_expr_->Evaluate(sheet);
 }
 
-FormulaAST::FormulaAST(std::unique_ptr<ASTImpl::Expr> root_expr, std::forward_list<Position> cells)
+FormulaAST::FormulaAST(std::unique_ptr<ASTImpl::Expr> root_expr, std::forward_list<Position> cells,
+                       std::forward_list<SheetPosition> sheet_cells)
     : root_expr_(std::move(root_expr))
-    , cells_(std::move(cells)) {
+    , cells_(std::move(cells))
+    , sheet_cells_(std::move(sheet_cells)) {
     cells_.sort();  // to avoid sorting in GetReferencedCells
+    sheet_cells_.sort();
+}
+
+FormulaAST::~FormulaAST() = default;
+
+void FormulaAST::ShareSubexpressions(SharedSubexpressions& pool) {
+    ASTImpl::ShareSubtree(root_expr_, pool);
 }
 
-FormulaAST::~FormulaAST() = default;
\ No newline at end of file
+void FormulaAST::RewriteCells(const std::function<Position(Position)>& rewrite,
+                              bool local, std::string_view sheet) {
+    // CellExpr nodes point into the lists, so the positions are changed in
+    // place; sorting relinks the nodes without moving them
+    if (local) {
+        for (Position& cell : cells_) {
+            cell = rewrite(cell);
+        }
+        cells_.sort();
+    }
+    if (!sheet.empty()) {
+        for (SheetPosition& cell : sheet_cells_) {
+            if (cell.sheet == sheet) {
+                cell.pos = rewrite(cell.pos);
+            }
+        }
+        sheet_cells_.sort();
+    }
+}
+
+void SharedSubexpressions::RewriteCells(const std::function<Position(Position)>& rewrite) {
+    std::vector<ASTImpl::SharedNode*> nodes;
+    nodes.reserve(nodes_.size());
+    for (auto& [key, node] : nodes_) {
+        nodes.push_back(node);
+    }
+    // subexpressions that became equal stay separate nodes with one key
+    nodes_.clear();
+    for (ASTImpl::SharedNode* node : nodes) {
+        nodes_.emplace(node->RewriteCells(rewrite), node);
+    }
+}
+
+SharedSubexpressions::~SharedSubexpressions() {
+    for (auto& [key, node] : nodes_) {
+        node->Detach();
+    }
+}
+
+size_t FormulaAST::GetMemoryUsage() const {
+    // forward_list node: the value and a pointer to the next node
+    size_t result = root_expr_->GetMemoryUsage();
+    result += std::distance(cells_.begin(), cells_.end()) *
+              (sizeof(void*) + sizeof(Position));
+    for (const SheetPosition& cell : sheet_cells_) {
+        result += sizeof(void*) + sizeof(SheetPosition) + cell.sheet.capacity();
+    }
+    return result;
+}
\ No newline at end of file
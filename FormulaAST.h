@@ -2,6 +2,7 @@
 
 #include "FormulaLexer.h"
 #include "common.h"
+#include "formula.h"
 
 #include <forward_list>
 #include <functional>
@@ -18,7 +19,8 @@ class ParsingError : public std::runtime_error {
 class FormulaAST {
 public:
     explicit FormulaAST(std::unique_ptr<ASTImpl::Expr> root_expr,
-                        std::forward_list<Position> cells);
+                        std::forward_list<Position> cells,
+                        std::forward_list<SheetPosition> sheet_cells = {});
     FormulaAST(FormulaAST&&) = default;
     FormulaAST& operator=(FormulaAST&&) = default;
     ~FormulaAST();
@@ -36,6 +38,25 @@ public:
         return cells_;
     }
 
+    // references to cells of other sheets, sorted
+    const std::forward_list<SheetPosition>& GetSheetCells() const {
+        return sheet_cells_;
+    }
+
+    // estimated heap memory owned by the AST and its cell lists, in bytes
+    size_t GetMemoryUsage() const;
+
+    // replaces each referenced position with rewrite(position) without
+    // reparsing: positions of cells of the sheet if local, and positions
+    // on the sheet with the given name if it is not empty. A position that
+    // becomes invalid is printed and evaluated as #REF!
+    void RewriteCells(const std::function<Position(Position)>& rewrite,
+                      bool local, std::string_view sheet);
+
+    // replaces subtrees that reference only cells of the sheet with nodes
+    // shared through the pool, so that their values are computed once
+    void ShareSubexpressions(SharedSubexpressions& pool);
+
 private:
     std::unique_ptr<ASTImpl::Expr> root_expr_;
 
@@ -43,6 +64,7 @@ private:
     // efficiently traversed without going through
     // the whole AST
     std::forward_list<Position> cells_;
+    std::forward_list<SheetPosition> sheet_cells_;
 };
 
 FormulaAST ParseFormulaAST(std::istream& in);
@@ -0,0 +1,160 @@
+#include "async_sheet.h"
+
+#include <algorithm>
+
+AsyncSheet::AsyncSheet(std::unique_ptr<Sheet> sheet)
+    : sheet_(std::move(sheet)) {
+  sheet_->Snapshot();
+  version_ = sheet_->GetVersion();
+  settled_version_ = version_;
+  worker_ = std::thread([this] { Run(); });
+}
+
+AsyncSheet::~AsyncSheet() {
+  {
+    interrupted_ = true;
+    std::lock_guard lock(mutex_);
+    stop_ = true;
+  }
+  changed_.notify_all();
+  worker_.join();
+}
+
+AsyncSheet::EditLock::EditLock(AsyncSheet& owner) : owner_(owner) {
+  ++owner_.waiting_editors_;
+  owner_.interrupted_ = true;
+  lock_ = std::unique_lock(owner_.mutex_);
+  --owner_.waiting_editors_;
+}
+
+AsyncSheet::EditLock::~EditLock() {
+  lock_.unlock();
+  owner_.changed_.notify_all();
+}
+
+uint64_t AsyncSheet::SetCell(Position pos, std::string text) {
+  EditLock lock(*this);
+  sheet_->SetCell(pos, std::move(text));
+  uint64_t version = sheet_->GetVersion();
+  version_ = version;
+  return version;
+}
+
+uint64_t AsyncSheet::ClearCell(Position pos) {
+  EditLock lock(*this);
+  sheet_->ClearCell(pos);
+  uint64_t version = sheet_->GetVersion();
+  version_ = version;
+  return version;
+}
+
+bool AsyncSheet::HotRegion::Contains(Position pos) const {
+  return pos.row >= top_left.row && pos.row < top_left.row + size.rows &&
+         pos.col >= top_left.col && pos.col < top_left.col + size.cols;
+}
+
+void AsyncSheet::SetHotRegions(std::vector<HotRegion> regions) {
+  EditLock lock(*this);
+  hot_regions_ = std::move(regions);
+  hot_regions_changed_ = true;
+}
+
+uint64_t AsyncSheet::GetVersion() const { return version_; }
+
+std::shared_ptr<const SheetSnapshot> AsyncSheet::GetPublishedSnapshot() const {
+  return sheet_->GetPublishedSnapshot();
+}
+
+std::shared_future<std::shared_ptr<const SheetSnapshot>>
+AsyncSheet::WhenSettled(uint64_t version) {
+  auto promise =
+      std::make_shared<std::promise<std::shared_ptr<const SheetSnapshot>>>();
+  std::shared_future<std::shared_ptr<const SheetSnapshot>> result =
+      promise->get_future().share();
+  OnSettled(version, [promise](std::shared_ptr<const SheetSnapshot> snapshot) {
+    promise->set_value(std::move(snapshot));
+  });
+  return result;
+}
+
+void AsyncSheet::OnSettled(uint64_t version, SettledCallback callback) {
+  {
+    std::lock_guard lock(waiters_mutex_);
+    if (version > settled_version_) {
+      waiters_.emplace(version, std::move(callback));
+      return;
+    }
+  }
+  callback(GetPublishedSnapshot());
+}
+
+bool AsyncSheet::Recalculate(std::unique_lock<std::mutex>& lock,
+                             uint64_t target) {
+  // Ячейки вычисляются по одной; редактор прерывает вычисление и получает
+  // таблицу. Правка делает версию устаревшей, и пересчёт начинается заново
+  // с уже вычисленными значениями в кэше.
+  EvaluationLimit limit;
+  limit.cancelled = &interrupted_;
+  hot_regions_changed_ = false;
+
+  auto cells = sheet_->GetUnpublishedCells();
+  auto is_hot = [this](Position pos) {
+    return std::any_of(
+        hot_regions_.begin(), hot_regions_.end(),
+        [pos](const HotRegion& region) { return region.Contains(pos); });
+  };
+  auto cold = std::stable_partition(cells.begin(), cells.end(), is_hot);
+
+  for (auto it = cells.begin(); it != cells.end(); ++it) {
+    if (it == cold && it != cells.begin()) {
+      sheet_->SnapshotSettled();
+    }
+    if (waiting_editors_ > 0) {
+      changed_.wait(lock, [this] { return waiting_editors_ == 0 || stop_; });
+    }
+    if (stop_ || hot_regions_changed_ || sheet_->GetVersion() != target) {
+      return false;
+    }
+    if (!sheet_->EvaluateWithin({*it}, limit)) {
+      // Прерывание сбрасывается только здесь, где оно обработано: флаг,
+      // поднятый до входа в пересчёт, не теряется
+      interrupted_ = false;
+      return false;
+    }
+  }
+  return true;
+}
+
+void AsyncSheet::Run() {
+  std::unique_lock lock(mutex_);
+  while (true) {
+    changed_.wait(lock, [this] {
+      return stop_ || sheet_->GetVersion() != settled_version_;
+    });
+    if (stop_) {
+      return;
+    }
+    uint64_t target = sheet_->GetVersion();
+    if (!Recalculate(lock, target)) {
+      continue;
+    }
+    auto snapshot = sheet_->Snapshot();
+
+    std::vector<SettledCallback> ready;
+    {
+      std::lock_guard waiters_lock(waiters_mutex_);
+      settled_version_ = target;
+      auto end = waiters_.upper_bound(target);
+      for (auto it = waiters_.begin(); it != end; ++it) {
+        ready.push_back(std::move(it->second));
+      }
+      waiters_.erase(waiters_.begin(), end);
+    }
+
+    lock.unlock();
+    for (auto& callback : ready) {
+      callback(snapshot);
+    }
+    lock.lock();
+  }
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "sheet.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Таблица с пересчётом в фоновом потоке. SetCell и ClearCell только применяют
+// правку (разбор формулы, проверка циклов, сброс кэша) и сразу возвращают
+// номер версии; значения вычисляет фоновый поток и публикует их снимком.
+// Новая правка прерывает пересчёт устаревшей версии: поток отдаёт таблицу
+// редактору и начинает заново с новой версии.
+//
+// Ячейки горячих областей (видимая часть листа, закреплённые выходы)
+// вычисляются первыми вместе со всеми ячейками, от которых они зависят.
+// Как только они готовы, публикуется неполный снимок с их новыми значениями,
+// а остальные ячейки вычисляются после него.
+//
+// Все методы можно вызывать из любых потоков.
+class AsyncSheet {
+ public:
+  using SettledCallback =
+      std::function<void(std::shared_ptr<const SheetSnapshot>)>;
+
+  struct HotRegion {
+    Position top_left;
+    Size size = {1, 1};
+
+    bool Contains(Position pos) const;
+  };
+
+  explicit AsyncSheet(std::unique_ptr<Sheet> sheet = std::make_unique<Sheet>());
+  AsyncSheet(const AsyncSheet&) = delete;
+  AsyncSheet& operator=(const AsyncSheet&) = delete;
+  // Останавливает фоновый поток. Невыполненные ожидания завершаются
+  // исключением std::future_error (broken_promise).
+  ~AsyncSheet();
+
+  // Исключения те же, что у Sheet; при ошибке версия не меняется
+  uint64_t SetCell(Position pos, std::string text);
+  uint64_t ClearCell(Position pos);
+
+  // Заменяет набор горячих областей; текущий пересчёт перестраивает порядок
+  void SetHotRegions(std::vector<HotRegion> regions);
+
+  uint64_t GetVersion() const;
+  // Последний опубликованный снимок. Он может быть неполным: пока
+  // вычисляются ячейки вне горячих областей, часть значений остаётся от
+  // прежней версии. Полноту показывает SheetSnapshot::IsComplete().
+  std::shared_ptr<const SheetSnapshot> GetPublishedSnapshot() const;
+
+  // Снимок версии не ниже version. Если правки идут быстрее пересчёта,
+  // промежуточные версии пропускаются и ожидание завершается более новой.
+  std::shared_future<std::shared_ptr<const SheetSnapshot>> WhenSettled(
+      uint64_t version);
+  // То же с обратным вызовом. Вызывается в фоновом потоке или сразу в
+  // вызывающем, если версия уже вычислена.
+  void OnSettled(uint64_t version, SettledCallback callback);
+
+ private:
+  // Захват таблицы для правки, не дожидаясь конца пересчёта. При выходе из
+  // области видимости, в том числе по исключению, отпускает таблицу и будит
+  // фоновый поток: иначе он остался бы ждать ушедшего редактора.
+  class EditLock {
+   public:
+    explicit EditLock(AsyncSheet& owner);
+    EditLock(const EditLock&) = delete;
+    EditLock& operator=(const EditLock&) = delete;
+    ~EditLock();
+
+   private:
+    AsyncSheet& owner_;
+    std::unique_lock<std::mutex> lock_;
+  };
+
+  void Run();
+  // Вычисляет изменившиеся ячейки версии target. false, если пересчёт
+  // прерван правкой.
+  bool Recalculate(std::unique_lock<std::mutex>& lock, uint64_t target);
+
+  std::unique_ptr<Sheet> sheet_;
+  // Таблица занята фоновым потоком на всё время пересчёта
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::atomic<int> waiting_editors_ = 0;
+  std::atomic<bool> interrupted_ = false;
+  // Версия таблицы, читается без mutex_
+  std::atomic<uint64_t> version_ = 0;
+  bool stop_ = false;
+  std::vector<HotRegion> hot_regions_;
+  bool hot_regions_changed_ = false;
+  // Ожидания и вычисленная версия; фоновый поток берёт этот мьютекс
+  // ненадолго, чтобы ожидающие не ждали конца пересчёта. settled_version_
+  // меняет только фоновый поток.
+  std::mutex waiters_mutex_;
+  uint64_t settled_version_ = 0;
+  std::multimap<uint64_t, SettledCallback> waiters_;
+  std::thread worker_;
+};
@@ -0,0 +1,398 @@
+#include "common.h"
+#include "formula.h"
+#include "sheet.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef __unix__
+#include <pthread.h>
+#endif
+
+// Нагрузочные тесты таблицы: spreadsheet_bench [--size N] [--rounds R]
+// [--seed S]. Для каждой синтетической нагрузки замеряются фазы разбора,
+// связывания ячеек, сброса кэша, вычисления и печати; отдельно замеряется
+// вычисление глубоких цепочек на потоке с маленьким стеком. Результат
+// печатается в stdout в формате JSON.
+namespace {
+using Clock = std::chrono::steady_clock;
+
+struct Config {
+  int size = 2000;
+  int rounds = 50;
+  uint32_t seed = 42;
+};
+
+// Набор ячеек и правка, после которой пересчитываются выходы
+struct Workload {
+  std::string name;
+  std::vector<std::pair<Position, std::string>> cells;
+  // Ячейка-вход, которую переписывает фаза invalidate
+  Position input;
+  std::vector<Position> outputs;
+};
+
+// Длительности операций одной фазы в наносекундах
+class PhaseStats {
+ public:
+  template <typename F>
+  void Measure(F&& operation) {
+    auto start = Clock::now();
+    operation();
+    auto elapsed = Clock::now() - start;
+    samples_.push_back(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+  }
+
+  // Медиана в наносекундах
+  int64_t GetMedian() const {
+    if (samples_.empty()) {
+      return 0;
+    }
+    std::vector<int64_t> sorted = samples_;
+    auto middle = sorted.begin() + sorted.size() / 2;
+    std::nth_element(sorted.begin(), middle, sorted.end());
+    return *middle;
+  }
+
+  void PrintJson(std::ostream& output) {
+    std::sort(samples_.begin(), samples_.end());
+    int64_t total = 0;
+    for (int64_t sample : samples_) {
+      total += sample;
+    }
+    double total_seconds = total / 1e9;
+    output << "{\"ops\": " << samples_.size()
+           << ", \"total_ms\": " << total / 1e6 << ", \"ops_per_sec\": "
+           << (total > 0 ? samples_.size() / total_seconds : 0.0)
+           << ", \"p50_us\": " << Percentile(0.5)
+           << ", \"p90_us\": " << Percentile(0.9)
+           << ", \"p99_us\": " << Percentile(0.99)
+           << ", \"max_us\": " << Percentile(1.0) << "}";
+  }
+
+ private:
+  double Percentile(double fraction) const {
+    if (samples_.empty()) {
+      return 0;
+    }
+    size_t index = static_cast<size_t>(fraction * (samples_.size() - 1));
+    return samples_[index] / 1e3;
+  }
+
+  std::vector<int64_t> samples_;
+};
+
+std::string CellName(int row, int col) {
+  return Position{row, col}.ToString();
+}
+
+// A1 <- A2 <- ... <- An: каждая ячейка зависит от предыдущей
+Workload MakeChain(const Config& config) {
+  Workload workload{"chain", {}, {0, 0}, {}};
+  workload.cells.emplace_back(Position{0, 0}, "1");
+  for (int row = 1; row < config.size; ++row) {
+    workload.cells.emplace_back(Position{row, 0},
+                                "=" + CellName(row - 1, 0) + "+1");
+  }
+  workload.outputs.push_back({config.size - 1, 0});
+  return workload;
+}
+
+// Все ячейки столбца B зависят от одной A1
+Workload MakeFanOut(const Config& config) {
+  Workload workload{"fan_out", {}, {0, 0}, {}};
+  workload.cells.emplace_back(Position{0, 0}, "1");
+  for (int row = 0; row < config.size; ++row) {
+    workload.cells.emplace_back(Position{row, 1},
+                                "=A1*" + std::to_string(row + 1));
+    workload.outputs.push_back({row, 1});
+  }
+  return workload;
+}
+
+// Два столбца, каждая строка которых зависит от обеих ячеек предыдущей:
+// число путей от входа к выходу растёт экспоненциально
+Workload MakeDiamonds(const Config& config) {
+  Workload workload{"diamonds", {}, {0, 0}, {}};
+  workload.cells.emplace_back(Position{0, 0}, "1");
+  workload.cells.emplace_back(Position{0, 1}, "2");
+  int rows = std::max(config.size / 2, 2);
+  for (int row = 1; row < rows; ++row) {
+    std::string a = CellName(row - 1, 0);
+    std::string b = CellName(row - 1, 1);
+    workload.cells.emplace_back(Position{row, 0}, "=(" + a + "+" + b + ")/2");
+    workload.cells.emplace_back(Position{row, 1}, "=" + a + "-" + b + "/2");
+  }
+  workload.outputs = {{rows - 1, 0}, {rows - 1, 1}};
+  return workload;
+}
+
+// Столбец данных и протянутая вниз формула нарастающего итога
+Workload MakeFillDown(const Config& config) {
+  Workload workload{"fill_down", {}, {0, 0}, {}};
+  for (int row = 0; row < config.size; ++row) {
+    workload.cells.emplace_back(Position{row, 0}, std::to_string(row % 100));
+  }
+  workload.cells.emplace_back(Position{0, 1}, "=A1");
+  for (int row = 1; row < config.size; ++row) {
+    workload.cells.emplace_back(Position{row, 1}, "=" + CellName(row - 1, 1) +
+                                                      "+" + CellName(row, 0) +
+                                                      "*2");
+  }
+  workload.outputs.push_back({config.size - 1, 1});
+  return workload;
+}
+
+// Случайные записи в разреженную область. Формулы ссылаются только на
+// строки выше себя, поэтому циклов не возникает.
+Workload MakeRandomSparse(const Config& config) {
+  Workload workload{"random_sparse", {}, {0, 0}, {}};
+  std::mt19937 random(config.seed);
+  const int rows = config.size * 4;
+  const int cols = 26;
+  std::uniform_int_distribution<int> col_dist(0, cols - 1);
+  workload.cells.emplace_back(Position{0, 0}, "1");
+  for (int i = 1; i < config.size; ++i) {
+    int row = std::uniform_int_distribution<int>(1, rows - 1)(random);
+    Position pos{row, col_dist(random)};
+    if (random() % 3 == 0) {
+      workload.cells.emplace_back(pos, std::to_string(random() % 1000));
+      continue;
+    }
+    std::string text = "=A1";
+    int refs = 1 + random() % 3;
+    for (int ref = 0; ref < refs; ++ref) {
+      int ref_row = std::uniform_int_distribution<int>(0, row - 1)(random);
+      text += "+" + CellName(ref_row, col_dist(random));
+    }
+    workload.cells.emplace_back(pos, std::move(text));
+    workload.outputs.push_back(pos);
+  }
+  return workload;
+}
+
+void RunWorkload(const Workload& workload, const Config& config,
+                 std::ostream& output) {
+  PhaseStats parse;
+  for (const auto& [pos, text] : workload.cells) {
+    if (text.size() > 1 && text[0] == FORMULA_SIGN) {
+      parse.Measure([&] { ParseFormula(text.substr(1)); });
+    }
+  }
+
+  Sheet sheet;
+  PhaseStats link;
+  for (const auto& [pos, text] : workload.cells) {
+    link.Measure([&] { sheet.SetCell(pos, text); });
+  }
+
+  PhaseStats invalidate;
+  PhaseStats evaluate;
+  PhaseStats print;
+  std::ostringstream sink;
+  for (int round = 0; round < config.rounds; ++round) {
+    if (round > 0) {
+      invalidate.Measure(
+          [&] { sheet.SetCell(workload.input, std::to_string(round % 7)); });
+    }
+    evaluate.Measure([&] {
+      for (Position pos : workload.outputs) {
+        sheet.GetCell(pos)->GetValue();
+      }
+    });
+    print.Measure([&] {
+      sink.str({});
+      sheet.PrintValues(sink);
+    });
+  }
+
+  output << "    {\"name\": \"" << workload.name
+         << "\", \"cells\": " << workload.cells.size() << ", \"phases\": {\n";
+  std::pair<const char*, PhaseStats*> phases[] = {
+      {"parse", &parse},           {"link", &link},
+      {"invalidate", &invalidate}, {"evaluate", &evaluate},
+      {"print", &print},
+  };
+  bool first = true;
+  for (auto& [name, stats] : phases) {
+    output << (first ? "" : ",\n") << "      \"" << name << "\": ";
+    stats->PrintJson(output);
+    first = false;
+  }
+  output << "\n    }}";
+}
+
+// Длины цепочек для замера глубины. В столбце не больше MAX_ROWS ячеек,
+// поэтому длинная цепочка переходит в следующий столбец.
+const int DEEP_CHAIN_LENGTHS[] = {1000, 10000, 100000, 1000000};
+// Пересчёт цепочки из миллиона ячеек идёт доли секунды, поэтому раундов
+// меньше, чем у остальных нагрузок
+const int DEEP_CHAIN_MAX_ROUNDS = 10;
+// Цена ячейки сравнивается с предыдущей, в 10 раз более короткой цепочкой.
+// При квадратичной сложности она выросла бы вдесятеро; рост в несколько раз
+// даёт кэш процессора, из которого длинная цепочка не помещается.
+const double DEEP_CHAIN_LINEAR_RATIO = 5.0;
+// Стек потока, на котором вычисляются цепочки: рекурсивное вычисление
+// переполнило бы его уже на первых тысячах звеньев
+const size_t DEEP_CHAIN_STACK_SIZE = 256 * 1024;
+
+Position DeepChainPosition(int index) {
+  return {index % Position::MAX_ROWS, index / Position::MAX_ROWS};
+}
+
+// Выполняет operation на отдельном потоке со стеком stack_size байт. Там,
+// где размер стека потока задать нельзя, выполняет на текущем потоке.
+void RunWithStack(size_t stack_size, const std::function<void()>& operation) {
+#ifdef __unix__
+  pthread_attr_t attributes;
+  pthread_attr_init(&attributes);
+  pthread_attr_setstacksize(&attributes, stack_size);
+  pthread_t thread;
+  auto entry = [](void* argument) -> void* {
+    (*static_cast<const std::function<void()>*>(argument))();
+    return nullptr;
+  };
+  int error = pthread_create(&thread, &attributes, entry,
+                             const_cast<std::function<void()>*>(&operation));
+  pthread_attr_destroy(&attributes);
+  if (error != 0) {
+    throw std::runtime_error("Failed to start evaluation thread");
+  }
+  pthread_join(thread, nullptr);
+#else
+  operation();
+#endif
+}
+
+// Время первого вычисления и медиана пересчёта на одну ячейку, нс
+struct DeepChainCost {
+  int length = 0;
+  double first = 0;
+  double reevaluate = 0;
+};
+
+// Первое вычисление и пересчёты после правки начала цепочки длиной length.
+// С ценой ячейки предыдущей цепочки previous сравнивается цена этой для
+// проверки линейности.
+DeepChainCost RunDeepChain(int length, const Config& config,
+                           const DeepChainCost& previous,
+                           std::ostream& output) {
+  Sheet sheet;
+  sheet.SetCell(DeepChainPosition(0), "1");
+  for (int i = 1; i < length; ++i) {
+    sheet.SetCell(DeepChainPosition(i),
+                  "=" + DeepChainPosition(i - 1).ToString() + "+1");
+  }
+  const CellInterface* last = sheet.GetCell(DeepChainPosition(length - 1));
+
+  PhaseStats first;
+  PhaseStats reevaluate;
+  bool correct = true;
+  RunWithStack(DEEP_CHAIN_STACK_SIZE, [&] {
+    first.Measure([&] { last->GetValue(); });
+    correct = last->GetValue() == CellInterface::Value(double(length));
+    int rounds = std::min(config.rounds, DEEP_CHAIN_MAX_ROUNDS);
+    for (int round = 1; round < rounds; ++round) {
+      sheet.SetCell(DeepChainPosition(0), std::to_string(round % 7));
+      reevaluate.Measure([&] { last->GetValue(); });
+    }
+  });
+
+  output << "    {\"length\": " << length << ", \"columns\": "
+         << DeepChainPosition(length - 1).col + 1
+         << ", \"stack_kb\": " << DEEP_CHAIN_STACK_SIZE / 1024
+         << ", \"correct\": " << (correct ? "true" : "false")
+         << ",\n      \"first\": ";
+  first.PrintJson(output);
+  output << ",\n      \"reevaluate\": ";
+  reevaluate.PrintJson(output);
+
+  DeepChainCost cost{length, first.GetMedian() / double(length),
+                     reevaluate.GetMedian() / double(length)};
+  output << ",\n      \"ns_per_cell\": {\"first\": " << cost.first
+         << ", \"reevaluate\": " << cost.reevaluate << "}";
+  if (previous.first > 0 && previous.reevaluate > 0) {
+    double first_ratio = cost.first / previous.first;
+    double reevaluate_ratio = cost.reevaluate / previous.reevaluate;
+    bool linear = first_ratio < DEEP_CHAIN_LINEAR_RATIO &&
+                  reevaluate_ratio < DEEP_CHAIN_LINEAR_RATIO;
+    output << ",\n      \"vs_previous\": {\"length\": " << previous.length
+           << ", \"first\": " << first_ratio
+           << ", \"reevaluate\": " << reevaluate_ratio
+           << ", \"linear\": " << (linear ? "true" : "false") << "}";
+  }
+  output << "}";
+  return cost;
+}
+
+Config ParseArguments(int argc, char* argv[]) {
+  Config config;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    std::string flag = argv[i];
+    long value = std::stol(argv[i + 1]);
+    if (flag == "--size") {
+      config.size = static_cast<int>(value);
+    } else if (flag == "--rounds") {
+      config.rounds = static_cast<int>(value);
+    } else if (flag == "--seed") {
+      config.seed = static_cast<uint32_t>(value);
+    } else {
+      throw std::invalid_argument("Unknown flag " + flag);
+    }
+  }
+  if (argc % 2 == 0) {
+    throw std::invalid_argument("Missing value for " +
+                                std::string(argv[argc - 1]));
+  }
+  if (config.size < 2 || config.size > Position::MAX_ROWS / 4 ||
+      config.rounds < 1) {
+    throw std::invalid_argument("Size or rounds out of range");
+  }
+  return config;
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  Config config;
+  try {
+    config = ParseArguments(argc, argv);
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << "\nUsage: " << argv[0]
+              << " [--size N] [--rounds R] [--seed S]\n";
+    return 2;
+  }
+
+  std::vector<std::function<Workload(const Config&)>> workloads = {
+      MakeChain, MakeFanOut, MakeDiamonds, MakeFillDown, MakeRandomSparse,
+  };
+  std::cout << std::fixed << std::setprecision(3);
+  std::cout << "{\n  \"config\": {\"size\": " << config.size
+            << ", \"rounds\": " << config.rounds
+            << ", \"seed\": " << config.seed << "},\n  \"workloads\": [\n";
+  bool first = true;
+  for (const auto& make : workloads) {
+    std::cout << (first ? "" : ",\n");
+    RunWorkload(make(config), config, std::cout);
+    first = false;
+  }
+  std::cout << "\n  ],\n  \"deep_chains\": [\n";
+  first = true;
+  DeepChainCost previous;
+  for (int length : DEEP_CHAIN_LENGTHS) {
+    std::cout << (first ? "" : ",\n");
+    previous = RunDeepChain(length, config, previous, std::cout);
+    first = false;
+  }
+  std::cout << "\n  ]\n}\n";
+  return 0;
+}
@@ -0,0 +1,300 @@
+#include "calc_server.h"
+
+#include <condition_variable>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#ifndef _WIN32
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+using namespace std::literals;
+
+namespace {
+// Первое слово команды и остаток строки после одного пробела
+std::pair<std::string_view, std::string_view> SplitWord(std::string_view line) {
+  size_t space = line.find(' ');
+  if (space == std::string_view::npos) {
+    return {line, {}};
+  }
+  return {line.substr(0, space), line.substr(space + 1)};
+}
+
+bool IsWrite(std::string_view line) {
+  auto verb = SplitWord(line).first;
+  return verb == "SET" || verb == "CLEAR";
+}
+
+Position ParsePosition(std::string_view str) {
+  Position pos = Position::FromString(str);
+  if (!pos.IsValid()) {
+    throw InvalidPositionException("Invalid position: " + std::string(str));
+  }
+  return pos;
+}
+}  // namespace
+
+CalcServer::CalcServer() { sheet_.Snapshot(); }
+
+CalcServer::Session::Session(CalcServer& server) : server_(server) {}
+
+std::unique_ptr<CalcServer::Session> CalcServer::OpenSession() {
+  return std::make_unique<Session>(*this);
+}
+
+uint64_t CalcServer::GetRecalculationCount() const { return recalculations_; }
+
+std::string CalcServer::Session::Feed(std::string_view bytes) {
+  buffer_.append(bytes);
+  std::string output;
+  std::vector<std::string_view> writes;
+  size_t start = 0;
+  for (size_t end = buffer_.find('\n'); end != std::string::npos;
+       end = buffer_.find('\n', start)) {
+    std::string_view line(buffer_.data() + start, end - start);
+    start = end + 1;
+    if (!line.empty() && line.back() == '\r') {
+      line.remove_suffix(1);
+    }
+    if (IsWrite(line)) {
+      writes.push_back(line);
+      continue;
+    }
+    if (!writes.empty()) {
+      ExecuteWrites(writes, output);
+      writes.clear();
+    }
+    ExecuteRead(line, output);
+  }
+  if (!writes.empty()) {
+    ExecuteWrites(writes, output);
+  }
+  buffer_.erase(0, start);
+  return output;
+}
+
+void CalcServer::Session::ExecuteWrites(
+    const std::vector<std::string_view>& commands, std::string& output) {
+  std::lock_guard lock(server_.write_mutex_);
+  for (std::string_view command : commands) {
+    auto [verb, args] = SplitWord(command);
+    try {
+      if (verb == "SET") {
+        auto [cell, text] = SplitWord(args);
+        server_.sheet_.SetCell(ParsePosition(cell), std::string(text));
+      } else {
+        server_.sheet_.ClearCell(ParsePosition(args));
+      }
+      output += "OK " + std::to_string(server_.sheet_.GetVersion()) + '\n';
+    } catch (const std::exception& e) {
+      output += "ERR "s + e.what() + '\n';
+    }
+  }
+  server_.sheet_.Snapshot();
+  ++server_.recalculations_;
+}
+
+void CalcServer::Session::ExecuteRead(std::string_view command,
+                                      std::string& output) {
+  auto snapshot = server_.sheet_.GetPublishedSnapshot();
+  auto [verb, args] = SplitWord(command);
+  try {
+    if (verb == "GET") {
+      std::ostringstream value;
+      if (const CellInterface* cell = snapshot->GetCell(ParsePosition(args))) {
+        value << cell->GetValue();
+      }
+      output += "VALUE " + value.str() + '\n';
+    } else if (verb == "PRINT" && (args == "VALUES" || args == "TEXTS")) {
+      std::ostringstream data;
+      if (args == "VALUES") {
+        snapshot->PrintValues(data);
+      } else {
+        snapshot->PrintTexts(data);
+      }
+      output += "DATA " + std::to_string(data.str().size()) + '\n';
+      output += data.str();
+    } else {
+      output += "ERR Unknown command\n";
+    }
+  } catch (const std::exception& e) {
+    output += "ERR "s + e.what() + '\n';
+  }
+}
+
+#ifdef _WIN32
+
+void CalcServer::ServeUnixSocket(const std::string&,
+                                 const std::atomic<bool>&) {
+  throw std::runtime_error("Unix domain sockets are not supported");
+}
+
+void CalcServer::ServeConnection(int, const std::atomic<bool>&) {}
+
+CalcClient::CalcClient(const std::string&) {
+  throw std::runtime_error("Unix domain sockets are not supported");
+}
+
+CalcClient::~CalcClient() {}
+
+std::vector<std::string> CalcClient::Call(const std::vector<std::string>&) {
+  return {};
+}
+
+void CalcClient::ReadAtLeast(size_t) {}
+
+#else
+
+namespace {
+sockaddr_un MakeAddress(const std::string& path) {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    throw std::runtime_error("Socket path is too long: " + path);
+  }
+  path.copy(address.sun_path, path.size());
+  return address;
+}
+
+void WriteAll(int fd, std::string_view data) {
+  while (!data.empty()) {
+    ssize_t written = send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+    if (written <= 0) {
+      throw std::runtime_error("Socket write failed");
+    }
+    data.remove_prefix(written);
+  }
+}
+
+// Ждёт данных на fd, проверяя stop; false, если пора завершаться
+bool WaitReadable(int fd, const std::atomic<bool>& stop) {
+  while (!stop) {
+    pollfd request{fd, POLLIN, 0};
+    int ready = poll(&request, 1, 100);
+    if (ready > 0) {
+      return true;
+    }
+    if (ready < 0) {
+      return false;
+    }
+  }
+  return false;
+}
+}  // namespace
+
+void CalcServer::ServeUnixSocket(const std::string& path,
+                                 const std::atomic<bool>& stop) {
+  sockaddr_un address = MakeAddress(path);
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener < 0) {
+    throw std::runtime_error("Failed to create socket");
+  }
+  unlink(path.c_str());
+  if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) <
+          0 ||
+      listen(listener, SOMAXCONN) < 0) {
+    close(listener);
+    throw std::runtime_error("Failed to listen on " + path);
+  }
+
+  std::mutex sessions_mutex;
+  std::condition_variable sessions_done;
+  int active_sessions = 0;
+  while (WaitReadable(listener, stop)) {
+    int fd = accept(listener, nullptr, nullptr);
+    if (fd < 0) {
+      continue;
+    }
+    {
+      std::lock_guard lock(sessions_mutex);
+      ++active_sessions;
+    }
+    std::thread([&, fd] {
+      ServeConnection(fd, stop);
+      std::lock_guard lock(sessions_mutex);
+      --active_sessions;
+      sessions_done.notify_all();
+    }).detach();
+  }
+
+  std::unique_lock lock(sessions_mutex);
+  sessions_done.wait(lock, [&] { return active_sessions == 0; });
+  close(listener);
+  unlink(path.c_str());
+}
+
+void CalcServer::ServeConnection(int fd, const std::atomic<bool>& stop) {
+  Session session(*this);
+  char buffer[1 << 16];
+  try {
+    while (WaitReadable(fd, stop)) {
+      ssize_t size = read(fd, buffer, sizeof(buffer));
+      if (size <= 0) {
+        break;
+      }
+      WriteAll(fd, session.Feed(std::string_view(buffer, size)));
+    }
+  } catch (const std::runtime_error&) {
+    // Клиент отключился, не дочитав ответы
+  }
+  close(fd);
+}
+
+CalcClient::CalcClient(const std::string& path) {
+  sockaddr_un address = MakeAddress(path);
+  fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd_ < 0 || connect(fd_, reinterpret_cast<sockaddr*>(&address),
+                         sizeof(address)) < 0) {
+    if (fd_ >= 0) {
+      close(fd_);
+    }
+    throw std::runtime_error("Failed to connect to " + path);
+  }
+}
+
+CalcClient::~CalcClient() { close(fd_); }
+
+void CalcClient::ReadAtLeast(size_t size) {
+  char chunk[1 << 16];
+  while (buffer_.size() < size) {
+    ssize_t read_size = read(fd_, chunk, sizeof(chunk));
+    if (read_size <= 0) {
+      throw std::runtime_error("Connection closed");
+    }
+    buffer_.append(chunk, read_size);
+  }
+}
+
+std::vector<std::string> CalcClient::Call(
+    const std::vector<std::string>& commands) {
+  std::string request;
+  for (const std::string& command : commands) {
+    request += command;
+    request += '\n';
+  }
+  WriteAll(fd_, request);
+
+  std::vector<std::string> responses;
+  while (responses.size() < commands.size()) {
+    size_t end;
+    while ((end = buffer_.find('\n')) == std::string::npos) {
+      ReadAtLeast(buffer_.size() + 1);
+    }
+    std::string response = buffer_.substr(0, end);
+    buffer_.erase(0, end + 1);
+    if (response.rfind("DATA ", 0) == 0) {
+      size_t size = std::stoul(response.substr(5));
+      ReadAtLeast(size);
+      response += '\n' + buffer_.substr(0, size);
+      buffer_.erase(0, size);
+    }
+    responses.push_back(std::move(response));
+  }
+  return responses;
+}
+
+#endif
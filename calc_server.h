@@ -0,0 +1,86 @@
+#pragma once
+
+#include "sheet.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Сервер вычислений: одна таблица, к которой подключаются клиенты по
+// строковому протоколу. Каждая команда - строка, завершённая '\n':
+//   SET <ячейка> <текст>   -> OK <версия>
+//   CLEAR <ячейка>         -> OK <версия>
+//   GET <ячейка>           -> VALUE <значение>  (пустая ячейка - пустое)
+//   PRINT VALUES|TEXTS     -> DATA <n>, затем n байт таблицы
+// При ошибке ответ - ERR <сообщение>. Команды можно отправлять, не дожидаясь
+// ответов: ответы приходят в порядке команд.
+//
+// Подряд идущие SET и CLEAR, уже полученные сервером, применяются пачкой с
+// одним пересчётом. Чтение обслуживается из опубликованного снимка без
+// блокировки, поэтому сессии чтения не мешают друг другу и писателю.
+class CalcServer {
+ public:
+  // Состояние протокола одного соединения
+  class Session {
+   public:
+    explicit Session(CalcServer& server);
+
+    // Принимает очередную порцию байт и возвращает ответы на все команды,
+    // которые в ней завершились. Неполная последняя строка ждёт следующей
+    // порции.
+    std::string Feed(std::string_view bytes);
+
+   private:
+    void ExecuteWrites(const std::vector<std::string_view>& commands,
+                       std::string& output);
+    void ExecuteRead(std::string_view command, std::string& output);
+
+    CalcServer& server_;
+    std::string buffer_;
+  };
+
+  CalcServer();
+
+  std::unique_ptr<Session> OpenSession();
+
+  // Принимает соединения на Unix-сокете path, пока stop не станет true.
+  // Каждое соединение обслуживается в отдельном потоке. Бросает
+  // std::runtime_error, если сокет не удалось открыть.
+  void ServeUnixSocket(const std::string& path, const std::atomic<bool>& stop);
+
+  // Число пересчётов, выполненных после пачек правок
+  uint64_t GetRecalculationCount() const;
+
+ private:
+  void ServeConnection(int fd, const std::atomic<bool>& stop);
+
+  Sheet sheet_;
+  std::mutex write_mutex_;
+  std::atomic<uint64_t> recalculations_ = 0;
+};
+
+// Клиент для CalcServer через Unix-сокет: отправляет пачку команд одним
+// пакетом и читает ответы на каждую. Бросает std::runtime_error при ошибке
+// соединения.
+class CalcClient {
+ public:
+  explicit CalcClient(const std::string& path);
+  CalcClient(const CalcClient&) = delete;
+  CalcClient& operator=(const CalcClient&) = delete;
+  ~CalcClient();
+
+  // Возвращает ответы в порядке команд. Для PRINT - строка "DATA <n>\n" и
+  // следом данные.
+  std::vector<std::string> Call(const std::vector<std::string>& commands);
+
+ private:
+  // Дочитывает из сокета, пока в буфере не наберётся size байт
+  void ReadAtLeast(size_t size);
+
+  int fd_ = -1;
+  std::string buffer_;
+};
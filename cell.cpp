@@ -1,172 +1,779 @@
 #include "cell.h"
 #include "sheet.h"
+#include "tracing.h"
+#include "value_cache.h"
 
+#include <algorithm>
 #include <cassert>
 #include <iostream>
 #include <string>
 #include <optional>
+#include <unordered_set>
 
-class Cell::Impl {
+class Cell::FormulaImpl {
  public:
-  virtual ~Impl() {}
-  virtual Value GetValue() const = 0;
-  virtual std::string GetText() const = 0;
-  virtual std::vector<Position> GetReferencedCells() const = 0;
-  virtual void DeleteCache() = 0;
-};
+  FormulaImpl(const Cell& cell, std::string text, bool deferred);
 
-class Cell::EmptyImpl : public Impl {
- public:
-  EmptyImpl() {}
+  std::string GetText() const;
 
-  Value GetValue() const override { return 0.0; }
+  CellInterface::Value CalculateFormula() const;
 
-  std::string GetText() const override { return ""; }
+  Value GetValue() const;
 
-  std::vector<Position> GetReferencedCells() const override { return {}; }
+  std::vector<Position> GetReferencedCells() const;
 
-  void DeleteCache() override{};
-};
+  std::vector<SheetPosition> GetSheetReferences() const {
+    return sheet_references_;
+  }
 
-class Cell::TextImpl : public Impl {
- public:
-  TextImpl(std::string text) : text_(text) {}
+  void DeleteCache();
+
+  void Validate() const;
 
-  std::string GetText() const override { return text_; }
+  void RewriteReferences(const std::function<Position(Position)>& rewrite,
+                         bool local, std::string_view sheet);
 
-  Value GetValue() const override;
+  bool HasCachedValue() const { return cache_valid_; }
+  bool IsCurrent() const { return cache_valid_ || evicted_; }
+  bool HoldsValue() const { return cache_ != nullptr; }
+  void EvictCache() const;
 
-  std::vector<Position> GetReferencedCells() const override { return {}; }
-  void DeleteCache() override {}
+  void RestoreCache(const Value& value) {
+    StoreValue(value);
+    cache_valid_ = true;
+  }
+
+  std::optional<Value> GetLastValue() const {
+    return cache_ ? std::optional<Value>(*cache_) : std::nullopt;
+  }
+
+  MemoryStats GetMemoryUsage() const;
 
  private:
-  std::string text_;
+  const FormulaInterface& GetFormula() const;
+  void StoreValue(Value value) const;
+  // Переносит изменение памяти в учёт таблицы, если формула уже в ячейке
+  void NoteMemoryChange(const MemoryStats& before) const;
+
+  const Cell& cell_;
+  const SheetInterface& sheet_;
+  mutable std::string expression_;
+  std::vector<Position> referenced_cells_;
+  std::vector<SheetPosition> sheet_references_;
+  mutable std::unique_ptr<FormulaInterface> formula_;
+  mutable size_t formula_bytes_ = 0;
+  // После сброса кэша значение остаётся как последнее известное. Значение
+  // хранится отдельно от формулы, чтобы вытеснение освобождало память.
+  mutable std::unique_ptr<CellInterface::Value> cache_;
+  mutable bool cache_valid_ = false;
+  // Актуальное значение освобождено по бюджету памяти
+  mutable bool evicted_ = false;
 };
 
-class Cell::FormulaImpl : public Impl {
- public:
-  FormulaImpl(const SheetInterface& sheet, std::string text);
+namespace {
+// Множество рёбер ячейки без рёбер
+const std::set<Cell*> NO_CELLS;
+}  // namespace
 
-  std::string GetText() const override;
+Cell::ShortText::ShortText(std::string_view text)
+    : size_(static_cast<uint8_t>(text.size())) {
+  assert(text.size() <= CAPACITY);
+  std::copy(text.begin(), text.end(), data_.begin());
+}
 
-  CellInterface::Value CalculateFormula() const;
+std::string_view Cell::ShortText::Get() const {
+  return {data_.data(), size_};
+}
 
-  Value GetValue() const override;
+Cell::Cell(Sheet& sheet, Position pos) : sheet_(sheet), pos_(pos) {
+  sheet_.AddMemoryUsage(GetMemoryUsage());
+}
 
-  std::vector<Position> GetReferencedCells() const override;
+Cell::~Cell() {
+  if (ValueCache* cache = sheet_.GetValueCache()) {
+    cache->Remove(this);
+  }
+  sheet_.RemoveMemoryUsage(GetMemoryUsage());
+  if (links_) {
+    MemoryStats usage;
+    usage.dependency_edges.bytes = sizeof(Links);
+    sheet_.RemoveMemoryUsage(usage);
+  }
+}
 
-  void DeleteCache() override;
+const std::set<Cell*>& Cell::GetReferencedCellSet() const {
+  return links_ ? links_->referensed_cells : NO_CELLS;
+}
 
- private:
-  const SheetInterface& sheet_;
-  std::unique_ptr<FormulaInterface> formula_;
-  mutable std::optional<CellInterface::Value> cache_;
-};
+Cell::Links& Cell::GetLinks() {
+  if (!links_) {
+    links_ = std::make_unique<Links>();
+    MemoryStats usage;
+    usage.dependency_edges.bytes = sizeof(Links);
+    sheet_.AddMemoryUsage(usage);
+  }
+  return *links_;
+}
 
+void Cell::ReleaseEmptyLinks() {
+  if (links_ && links_->dependent_cells.empty() &&
+      links_->referensed_cells.empty()) {
+    links_.reset();
+    MemoryStats usage;
+    usage.dependency_edges.bytes = sizeof(Links);
+    sheet_.RemoveMemoryUsage(usage);
+  }
+}
+
+void Cell::ReplaceContent(Content content) {
+  if (ValueCache* cache = sheet_.GetValueCache()) {
+    cache->Remove(this);
+  }
+  sheet_.RemoveMemoryUsage(GetContentMemoryUsage());
+  content_ = std::move(content);
+  sheet_.AddMemoryUsage(GetContentMemoryUsage());
+}
+
+MemoryStats Cell::GetMemoryUsage() const {
+  MemoryStats usage = GetContentMemoryUsage();
+  usage.cells.bytes += sizeof(*this);
+  ++usage.cells.count;
+  return usage;
+}
+
+MemoryStats Cell::GetContentMemoryUsage() const {
+  if (const FormulaImpl* formula = GetFormulaImpl()) {
+    return formula->GetMemoryUsage();
+  }
+  // Строки пула учитывает сама таблица: одна строка на много ячеек
+  MemoryStats usage;
+  if (std::holds_alternative<ShortText>(content_)) {
+    usage.texts = {0, 1};
+  }
+  return usage;
+}
+
+Cell::Content Cell::MakeTextContent(std::string text) const {
+  if (text.size() <= ShortText::CAPACITY) {
+    return ShortText(text);
+  }
+  return sheet_.GetStringPool().Intern(text);
+}
 
-Cell::Cell(Sheet& sheet) : sheet_(sheet) { Clear(); }
+std::optional<std::string_view> Cell::GetStoredText() const {
+  if (const auto* text = std::get_if<ShortText>(&content_)) {
+    return text->Get();
+  }
+  if (const auto* text = std::get_if<StringPool::Ref>(&content_)) {
+    return text->Get();
+  }
+  return std::nullopt;
+}
 
-Cell::~Cell() {}
+Cell::FormulaImpl* Cell::GetFormulaImpl() const {
+  const auto* formula = std::get_if<std::unique_ptr<FormulaImpl>>(&content_);
+  return formula ? formula->get() : nullptr;
+}
 
-void Cell::CheckForCycles(std::vector<Position> references, Cell* root) {
+Cell::Value Cell::GetContentValue() const {
+  if (const FormulaImpl* formula = GetFormulaImpl()) {
+    return formula->GetValue();
+  }
+  if (IsEmpty()) {
+    return 0.0;
+  }
+  return std::string(*GetTextValueView());
+}
+
+bool Cell::IsCurrent() const {
+  const FormulaImpl* formula = GetFormulaImpl();
+  return !formula || formula->IsCurrent();
+}
+
+void Cell::InvalidateValue() const {
+  if (FormulaImpl* formula = GetFormulaImpl()) {
+    formula->DeleteCache();
+  }
+}
 
-  for (const auto& parent_pos : references) {
-    if (auto parent = dynamic_cast<Cell*>(sheet_.GetCell(parent_pos))) {
-      if (parent == root) {
-        throw CircularDependencyException("Cycle found!");
+void Cell::CheckForCycles(const std::vector<Position>& references,
+                          const SheetReferences& sheet_references) const {
+  TraceSpan span("Cell::CheckForCycles");
+  // Цикл появится, если ячейка сама или какая-то из зависящих от неё ячеек
+  // окажется среди новых ссылок. Обходим зависимые, а не ссылки: при
+  // заполнении цепочки вниз у новой ячейки ещё нет зависимых.
+  auto is_referenced = [&](const Cell* cell) {
+    if (&cell->sheet_ == &sheet_ &&
+        std::binary_search(references.begin(), references.end(),
+                           cell->pos_)) {
+      return true;
+    }
+    SheetReferences::value_type ref(&cell->sheet_, cell->pos_);
+    return std::find(sheet_references.begin(), sheet_references.end(), ref) !=
+           sheet_references.end();
+  };
+
+  std::unordered_set<const Cell*> visited{this};
+  std::vector<const Cell*> worklist{this};
+  while (!worklist.empty()) {
+    const Cell* cell = worklist.back();
+    worklist.pop_back();
+    if (is_referenced(cell)) {
+      throw CircularDependencyException("Cycle found!");
+    }
+    for (const Cell* dependent : cell->GetDependentCells()) {
+      if (visited.insert(dependent).second) {
+        worklist.push_back(dependent);
       }
-      parent->CheckForCycles(parent->GetReferencedCells(), root);
     }
   }
 }
 
 void Cell::Set(std::string text) {
-  if (text == impl_->GetText()) {
+  TraceSpan span("Cell::Set");
+  std::optional<std::string_view> current = GetTextView();
+  if (current ? text == *current : text == GetText()) {
     return;
   }
-
   if (text.empty()) {
     Clear();
-  } else if (text.front() == FORMULA_SIGN && text.size() > 1) {
-    auto tmp_impl = std::make_unique<FormulaImpl>(sheet_, text.substr(1));
-    CheckForCycles(tmp_impl->GetReferencedCells(), this);
-    impl_ = std::move(tmp_impl);
+    return;
+  }
+
+  Content content;
+  if (text.front() == FORMULA_SIGN && text.size() > 1) {
+    auto formula = std::make_unique<FormulaImpl>(*this, text.substr(1),
+                                                 sheet_.IsDeferredParsing());
+    CheckForCycles(formula->GetReferencedCells(),
+                   ResolveSheetReferences(formula->GetSheetReferences()));
+    content = std::move(formula);
   } else {
-    impl_ = std::make_unique<TextImpl>(text);
+    content = MakeTextContent(std::move(text));
   }
+
+  std::optional<Value> old_value = GetCachedValue();
+  sheet_.NoteValueChange(*this);
   ClearReferencedCells();
+  ReplaceContent(std::move(content));
   FillReferencedCells();
-  DeleteCache();
+  PropagateChange(old_value);
+}
+
+void Cell::Restore(const CellInterface& source) {
+  std::string text = source.GetText();
+  // Как в Set: одиночный знак '=' - это текст, а не формула
+  if (text.front() == FORMULA_SIGN && text.size() > 1) {
+    auto formula = std::make_unique<FormulaImpl>(*this, text.substr(1),
+                                                 sheet_.IsDeferredParsing());
+    formula->RestoreCache(source.GetValue());
+    ReplaceContent(std::move(formula));
+  } else {
+    ReplaceContent(MakeTextContent(std::move(text)));
+  }
+  FillReferencedCells();
+}
+
+void Cell::LinkReferencedCell(Cell* cell) {
+  if (cell->GetLinks().dependent_cells.insert(this).second) {
+    cell->sheet_.AddMemoryUsage(MemoryStats::ForEdges(1));
+  }
+  if (GetLinks().referensed_cells.insert(cell).second) {
+    sheet_.AddMemoryUsage(MemoryStats::ForEdges(1));
+  }
+}
+
+Cell::SheetReferences Cell::ResolveSheetReferences(
+    const std::vector<SheetPosition>& references) const {
+  SheetReferences result;
+  for (const SheetPosition& ref : references) {
+    const Sheet* sheet = sheet_.GetWorkbookSheet(ref.sheet);
+    if (sheet == nullptr) {
+      throw FormulaException("Unknown sheet: " + ref.sheet);
+    }
+    result.emplace_back(sheet, ref.pos);
+  }
+  return result;
 }
 
 void Cell::FillReferencedCells() {
+  TraceSpan span("Cell::FillReferencedCells");
   for (const Position& ref_pos : GetReferencedCells()) {
     if (!ref_pos.IsValid()) {
       throw InvalidPositionException("Invalid position");
     }
-    CellInterface* cell_interface = sheet_.GetCell(ref_pos);
-    if (cell_interface == nullptr) {
-      sheet_.SetCell(ref_pos, "");
+    if (Cell* cell = sheet_.GetCellForReference(ref_pos, *this)) {
+      LinkReferencedCell(cell);
+    }
+  }
+  // Рёбра графа зависимостей связывают ячейки разных листов напрямую, поэтому
+  // сброс кэша и вычисление проходят через листы без дополнительных структур
+  for (const SheetPosition& ref : GetSheetReferences()) {
+    Sheet* sheet = sheet_.GetWorkbookSheet(ref.sheet);
+    if (sheet == nullptr) {
+      continue;
+    }
+    if (Cell* cell = sheet->GetCellForReference(ref.pos, *this)) {
+      LinkReferencedCell(cell);
     }
-    Cell* cell = sheet_.GetCellPtr(ref_pos);
-    cell->dependent_cells_.insert(this);
-    referensed_cells_.insert(cell);
   }
 }
 
 void Cell::ClearReferencedCells() {
-  for (auto ref_cell : referensed_cells_) {
-    ref_cell->dependent_cells_.erase(this);
+  TraceSpan span("Cell::ClearReferencedCells");
+  if (links_) {
+    for (Cell* ref_cell : links_->referensed_cells) {
+      ref_cell->sheet_.RemoveMemoryUsage(MemoryStats::ForEdges(
+          ref_cell->links_->dependent_cells.erase(this)));
+      ref_cell->ReleaseEmptyLinks();
+    }
+    sheet_.RemoveMemoryUsage(
+        MemoryStats::ForEdges(links_->referensed_cells.size()));
+    links_->referensed_cells.clear();
+    ReleaseEmptyLinks();
   }
-  referensed_cells_.clear();
+  sheet_.UnlinkReferences(*this, GetReferencedCells());
+  for (const SheetPosition& ref : GetSheetReferences()) {
+    if (Sheet* sheet = sheet_.GetWorkbookSheet(ref.sheet)) {
+      sheet->UnlinkReferences(*this, {ref.pos});
+    }
+  }
+}
+
+std::vector<Cell*> Cell::UnlinkDependents() {
+  const std::set<Cell*>& dependent_cells = GetDependentCells();
+  std::vector<Cell*> dependents(dependent_cells.begin(),
+                                dependent_cells.end());
+  for (Cell* dependent : dependents) {
+    dependent->sheet_.RemoveMemoryUsage(MemoryStats::ForEdges(
+        dependent->links_->referensed_cells.erase(this)));
+    dependent->ReleaseEmptyLinks();
+  }
+  if (links_) {
+    sheet_.RemoveMemoryUsage(
+        MemoryStats::ForEdges(links_->dependent_cells.size()));
+    links_->dependent_cells.clear();
+    ReleaseEmptyLinks();
+  }
+  return dependents;
+}
+
+const std::set<Cell*>& Cell::GetDependentCells() const {
+  return links_ ? links_->dependent_cells : NO_CELLS;
+}
+
+void Cell::MoveTo(Position pos) { pos_ = pos; }
+
+void Cell::RewriteReferences(const Sheet& sheet,
+                             const std::function<Position(Position)>& rewrite) {
+  FormulaImpl* formula = GetFormulaImpl();
+  if (!formula) {
+    return;
+  }
+  // Лист может упоминаться по имени и в формулах его собственных ячеек
+  std::string name;
+  for (const SheetPosition& ref : formula->GetSheetReferences()) {
+    if (sheet_.GetWorkbookSheet(ref.sheet) == &sheet) {
+      name = ref.sheet;
+      break;
+    }
+  }
+  formula->RewriteReferences(rewrite, &sheet == &sheet_, name);
+  DeleteCache();
 }
 
 void Cell::Clear() {
-  impl_ = std::make_unique<EmptyImpl>();
+  std::optional<Value> old_value = GetCachedValue();
+  sheet_.NoteValueChange(*this);
   ClearReferencedCells();
-  DeleteCache();
+  ReplaceContent(std::monostate());
+  PropagateChange(old_value);
 }
 
-Cell::Value Cell::GetValue() const { return impl_->GetValue(); }
-std::string Cell::GetText() const { return impl_->GetText(); }
+Cell::Value Cell::GetValue() const {
+  WorkloadRecorder::CallScope scope;
+  if (!HasCachedValue()) {
+    EvaluateReferencedCells();
+  }
+  Value value = GetContentValue();
+  if (WorkloadRecorder* recorder = sheet_.GetRecorder();
+      recorder && scope.IsOutermost()) {
+    recorder->Log(TraceOperation::GET_VALUE, pos_);
+  }
+  return value;
+}
+
+bool Cell::Evaluate(const EvaluationLimit& limit,
+                    std::vector<Position>* settled) const {
+  if (HasCachedValue()) {
+    return true;
+  }
+  if (!EvaluateReferencedCells(&limit, settled) || limit.IsExpired()) {
+    return false;
+  }
+  GetContentValue();
+  if (settled) {
+    settled->push_back(pos_);
+  }
+  return true;
+}
+
+std::optional<Cell::Value> Cell::GetLastValue() const {
+  if (const FormulaImpl* formula = GetFormulaImpl()) {
+    return formula->GetLastValue();
+  }
+  return GetContentValue();
+}
+
+std::string Cell::GetText() const {
+  if (const FormulaImpl* formula = GetFormulaImpl()) {
+    return formula->GetText();
+  }
+  if (std::optional<std::string_view> text = GetStoredText()) {
+    return std::string(*text);
+  }
+  return "";
+}
+
+std::optional<std::string_view> Cell::GetTextView() const {
+  if (GetFormulaImpl()) {
+    return std::nullopt;
+  }
+  return GetStoredText().value_or(std::string_view());
+}
+
+std::optional<std::string_view> Cell::GetTextValueView() const {
+  std::optional<std::string_view> text = GetTextView();
+  if (text && !text->empty() && text->front() == ESCAPE_SIGN) {
+    text->remove_prefix(1);
+  }
+  return text;
+}
 
 std::vector<Position> Cell::GetReferencedCells() const {
-  return impl_->GetReferencedCells();
+  if (const FormulaImpl* formula = GetFormulaImpl()) {
+    return formula->GetReferencedCells();
+  }
+  return {};
 }
 
-bool Cell::IsReferenced() const { return !dependent_cells_.empty(); }
+std::vector<SheetPosition> Cell::GetSheetReferences() const {
+  if (const FormulaImpl* formula = GetFormulaImpl()) {
+    return formula->GetSheetReferences();
+  }
+  return {};
+}
+
+bool Cell::IsReferenced() const { return !GetDependentCells().empty(); }
+
+void Cell::Validate() const {
+  if (const FormulaImpl* formula = GetFormulaImpl()) {
+    formula->Validate();
+  }
+}
+
+bool Cell::IsEmpty() const {
+  return std::holds_alternative<std::monostate>(content_);
+}
+
+bool Cell::HasCachedValue() const {
+  const FormulaImpl* formula = GetFormulaImpl();
+  return !formula || formula->HasCachedValue();
+}
+
+bool Cell::HoldsFormulaValue() const {
+  const FormulaImpl* formula = GetFormulaImpl();
+  return formula && formula->HoldsValue();
+}
+
+void Cell::EvictValue() const {
+  if (const FormulaImpl* formula = GetFormulaImpl()) {
+    formula->EvictCache();
+  }
+}
+
+Position Cell::GetPosition() const { return pos_; }
+
+std::optional<Cell::Value> Cell::GetCachedValue() const {
+  if (!HasCachedValue()) {
+    return std::nullopt;
+  }
+  // Не GetValue: сравнение с прежним значением не считается чтением кэша
+  return GetLastValue();
+}
+
+std::vector<Cell*> Cell::GetDependentsInTopologicalOrder() {
+  // Обратный порядок выхода из обхода в глубину по зависимым ячейкам
+  std::vector<Cell*> order;
+  std::unordered_set<const Cell*> visited{this};
+  std::vector<std::pair<Cell*, std::set<Cell*>::const_iterator>> stack;
+  stack.emplace_back(this, GetDependentCells().begin());
+  while (!stack.empty()) {
+    auto& [cell, it] = stack.back();
+    if (it == cell->GetDependentCells().end()) {
+      if (cell != this) {
+        order.push_back(cell);
+      }
+      stack.pop_back();
+      continue;
+    }
+    Cell* next = *it++;
+    if (visited.insert(next).second) {
+      stack.emplace_back(next, next->GetDependentCells().begin());
+    }
+  }
+  std::reverse(order.begin(), order.end());
+  return order;
+}
+
+void Cell::PropagateChange(const std::optional<Value>& old_value) {
+  TraceSpan span("Cell::PropagateChange");
+  if (!sheet_.IsEagerRecalculation()) {
+    DeleteCache();
+    return;
+  }
+
+  // Пересчитываем ячейку сразу и идём дальше по зависимым, только если
+  // значение действительно изменилось. Невычисленные ячейки остаются
+  // ленивыми, но изменение через них передаётся дальше.
+  if (old_value && *old_value == GetValue()) {
+    return;
+  }
+  std::unordered_set<const Cell*> changed{this};
+  size_t fanout = 0;
+  for (Cell* cell : GetDependentsInTopologicalOrder()) {
+    const std::set<Cell*>& inputs = cell->GetReferencedCellSet();
+    bool inputs_changed =
+        std::any_of(inputs.begin(), inputs.end(), [&changed](const Cell* ref) {
+          return changed.count(ref) != 0;
+        });
+    if (!inputs_changed) {
+      continue;
+    }
+    std::optional<Value> previous = cell->GetCachedValue();
+    cell->sheet_.NoteValueChange(*cell);
+    cell->InvalidateValue();
+    ++fanout;
+    if (!previous || !(*previous == cell->GetValue())) {
+      changed.insert(cell);
+    }
+  }
+  if (SheetProfile* profile = sheet_.GetProfiler()) {
+    profile->RecordInvalidation(pos_, fanout);
+  }
+}
 
 
 void Cell::DeleteCache() const {
-  impl_->DeleteCache();
-  for (Cell* cell : dependent_cells_) {
-    cell->DeleteCache();
+  TraceSpan span("Cell::DeleteCache");
+  sheet_.NoteValueChange(*this);
+  InvalidateValue();
+
+  // Устаревшая ячейка уже сброшена вместе со всеми зависимыми: значение
+  // формулы кэшируется только после того, как закэшированы её аргументы.
+  // Через вытесненную ячейку сброс проходит: её зависимые могут быть в кэше.
+  const std::set<Cell*>& dependent_cells = GetDependentCells();
+  std::vector<const Cell*> worklist(dependent_cells.begin(),
+                                    dependent_cells.end());
+  size_t fanout = 0;
+  while (!worklist.empty()) {
+    const Cell* cell = worklist.back();
+    worklist.pop_back();
+    if (!cell->IsCurrent()) {
+      continue;
+    }
+    cell->sheet_.NoteValueChange(*cell);
+    cell->InvalidateValue();
+    ++fanout;
+    const std::set<Cell*>& dependents = cell->GetDependentCells();
+    worklist.insert(worklist.end(), dependents.begin(), dependents.end());
+  }
+  if (SheetProfile* profile = sheet_.GetProfiler()) {
+    profile->RecordInvalidation(pos_, fanout);
   }
 }
 
-Cell::Value Cell::TextImpl::GetValue() const {
-  std::string value;
-  if (text_.front() == ESCAPE_SIGN) {
-    return text_.substr(1);
+bool Cell::EvaluateReferencedCells(const EvaluationLimit* limit,
+                                   std::vector<Position>* settled) const {
+  TraceSpan span("Cell::EvaluateReferencedCells");
+  // Вычисляет аргументы формулы в порядке выхода из обхода в глубину, чтобы
+  // к моменту вычисления каждой ячейки её аргументы уже были в кэше и
+  // CellExpr::Evaluate не уходил в рекурсию по цепочке ссылок. Без циклов
+  // ячейка без значения не может встретиться второй раз, пока она в стеке,
+  // поэтому отдельное множество посещённых не нужно: вычисленная ячейка
+  // дальше пропускается, а вытесненная вычисляется заново.
+  //
+  // При бюджете памяти аргументы ячеек в стеке удерживаются в кэше до
+  // вычисления самой ячейки: иначе вычисление следующего аргумента могло бы
+  // вытеснить предыдущий, и формула вычисляла бы его рекурсивно.
+  struct Frame {
+    const Cell* cell;
+    std::set<Cell*>::const_iterator it;
+    std::vector<const Cell*> held;
+
+    void Release() const {
+      for (const Cell* arg : held) {
+        arg->sheet_.GetValueCache()->Release(arg);
+      }
+    }
+  };
+  auto hold = [](Frame& frame, const Cell* arg) {
+    if (ValueCache* cache = arg->sheet_.GetValueCache();
+        cache && arg->HoldsFormulaValue()) {
+      cache->Hold(arg);
+      frame.held.push_back(arg);
+    }
+  };
+  // Удержания оставшихся в стеке ячеек снимаются при любом выходе: после
+  // исключения (ошибка разбора отложенной формулы) ячейки иначе остались
+  // бы невытесняемыми навсегда
+  struct ReleaseOnExit {
+    const std::vector<Frame>& stack;
+
+    ~ReleaseOnExit() {
+      for (const Frame& frame : stack) {
+        frame.Release();
+      }
+    }
+  };
+
+  std::vector<Frame> stack;
+  ReleaseOnExit release_on_exit{stack};
+  stack.push_back({this, GetReferencedCellSet().begin(), {}});
+  while (!stack.empty()) {
+    Frame& frame = stack.back();
+    const Cell* cell = frame.cell;
+    if (frame.it == cell->GetReferencedCellSet().end()) {
+      if (cell != this) {
+        if (limit && limit->IsExpired()) {
+          return false;
+        }
+        cell->GetContentValue();
+        if (settled) {
+          settled->push_back(cell->pos_);
+        }
+      }
+      frame.Release();
+      stack.pop_back();
+      if (!stack.empty()) {
+        hold(stack.back(), cell);
+      }
+      continue;
+    }
+    const Cell* next = *frame.it++;
+    if (next->HasCachedValue()) {
+      hold(frame, next);
+    } else {
+      stack.push_back({next, next->GetReferencedCellSet().begin(), {}});
+    }
+  }
+  return true;
+}
+
+EvaluationLimit EvaluationLimit::Within(Clock::duration budget) {
+  EvaluationLimit limit;
+  limit.deadline = Clock::now() + budget;
+  return limit;
+}
+
+bool EvaluationLimit::IsExpired() const {
+  if (cancelled && cancelled->load(std::memory_order_relaxed)) {
+    return true;
+  }
+  return deadline != Clock::time_point::max() && Clock::now() >= deadline;
+}
+
+Cell::FormulaImpl::FormulaImpl(const Cell& cell, std::string text,
+                               bool deferred)
+    : cell_(cell), sheet_(cell.sheet_), expression_(std::move(text)) {
+  if (deferred) {
+    referenced_cells_ = ScanFormulaReferences(expression_);
+    sheet_references_ = ScanSheetReferences(expression_);
+    return;
+  }
+  GetFormula();
+  referenced_cells_ = formula_->GetReferencedCells();
+  sheet_references_ = formula_->GetSheetReferences();
+}
+
+const FormulaInterface& Cell::FormulaImpl::GetFormula() const {
+  if (!formula_) {
+    SheetProfile* profile = cell_.sheet_.GetProfiler();
+    auto start = profile ? std::chrono::steady_clock::now()
+                         : std::chrono::steady_clock::time_point();
+    TraceSpan span("Cell::ParseFormula");
+    MemoryStats before = GetMemoryUsage();
+    try {
+      formula_ = ParseFormula(expression_,
+                              cell_.sheet_.GetSharedSubexpressions());
+    } catch (...) {
+      throw FormulaException("Failed to parse formula");
+    }
+    expression_.clear();
+    formula_bytes_ = formula_->GetMemoryUsage();
+    NoteMemoryChange(before);
+    if (profile) {
+      profile->RecordParse(cell_.pos_,
+                           std::chrono::steady_clock::now() - start);
+    }
   }
-  return text_;
+  return *formula_;
 }
 
-Cell::FormulaImpl::FormulaImpl(const SheetInterface& sheet, std::string text)
-    : sheet_(sheet) {
+void Cell::FormulaImpl::Validate() const { GetFormula(); }
+
+void Cell::FormulaImpl::RewriteReferences(
+    const std::function<Position(Position)>& rewrite, bool local,
+    std::string_view sheet) {
+  MemoryStats before = GetMemoryUsage();
   try {
-    formula_ = ParseFormula(text);
-  } catch (...) {
-    throw FormulaException("Failed to parse formula");
-  }  
+    // Текст отложенной формулы не переписать, поэтому она разбирается
+    GetFormula();
+  } catch (const FormulaException&) {
+    // Формула с ошибкой сохраняет введённый текст, но списки ссылок
+    // переписываются: по ним таблица находит рёбра и записи индекса
+  }
+  if (formula_) {
+    formula_->RewriteReferences(rewrite, local, sheet);
+    referenced_cells_ = formula_->GetReferencedCells();
+    sheet_references_ = formula_->GetSheetReferences();
+  } else {
+    std::vector<Position> cells;
+    for (Position pos : referenced_cells_) {
+      if (Position rewritten = local ? rewrite(pos) : pos;
+          rewritten.IsValid()) {
+        cells.push_back(rewritten);
+      }
+    }
+    std::sort(cells.begin(), cells.end());
+    referenced_cells_ = std::move(cells);
+    std::vector<SheetPosition> sheet_cells;
+    for (SheetPosition& ref : sheet_references_) {
+      if (!sheet.empty() && ref.sheet == sheet) {
+        ref.pos = rewrite(ref.pos);
+      }
+      if (ref.pos.IsValid()) {
+        sheet_cells.push_back(std::move(ref));
+      }
+    }
+    std::sort(sheet_cells.begin(), sheet_cells.end());
+    sheet_references_ = std::move(sheet_cells);
+  }
+  formula_bytes_ = formula_ ? formula_->GetMemoryUsage() : 0;
+  NoteMemoryChange(before);
 }
 
 std::string Cell::FormulaImpl::GetText() const {
-  return FORMULA_SIGN + formula_->GetExpression();
+  try {
+    return FORMULA_SIGN + GetFormula().GetExpression();
+  } catch (const FormulaException&) {
+    // Отложенная формула с ошибкой остаётся в том виде, в каком её ввели
+    return FORMULA_SIGN + expression_;
+  }
 }
 
 CellInterface::Value Cell::FormulaImpl::CalculateFormula() const {
-  FormulaInterface::Value evaluate_result = formula_->Evaluate(sheet_);
+  TraceSpan span("Cell::CalculateFormula");
+  FormulaInterface::Value evaluate_result = GetFormula().Evaluate(sheet_);
   CellInterface::Value result;
   if (std::holds_alternative<double>(evaluate_result)) {
     result = std::get<double>(evaluate_result);
@@ -177,14 +784,84 @@ CellInterface::Value Cell::FormulaImpl::CalculateFormula() const {
 }
 
 Cell::Value Cell::FormulaImpl::GetValue() const {
-  if (cache_ == std::nullopt) {
-    cache_ = CalculateFormula();
+  SheetProfile* profile = cell_.sheet_.GetProfiler();
+  ValueCache* value_cache = cell_.sheet_.GetValueCache();
+  if (cache_valid_) {
+    if (profile) {
+      profile->RecordCacheHit(cell_.pos_);
+    }
+    if (value_cache) {
+      value_cache->Touch(&cell_);
+    }
+  } else {
+    // Устаревшее значение после сброса кэша уже учтено
+    std::optional<MemoryStats> before;
+    if (!cache_) {
+      before = GetMemoryUsage();
+    }
+    if (profile) {
+      auto start = std::chrono::steady_clock::now();
+      StoreValue(CalculateFormula());
+      profile->RecordEvaluation(cell_.pos_,
+                                std::chrono::steady_clock::now() - start);
+    } else {
+      StoreValue(CalculateFormula());
+    }
+    cache_valid_ = true;
+    evicted_ = false;
+    if (before) {
+      NoteMemoryChange(*before);
+      if (value_cache && cell_.GetFormulaImpl() == this) {
+        value_cache->Insert(&cell_);
+      }
+    }
+  }
+  return *cache_;
+}
+
+void Cell::FormulaImpl::StoreValue(Value value) const {
+  if (cache_) {
+    *cache_ = std::move(value);
+  } else {
+    cache_ = std::make_unique<Value>(std::move(value));
   }
-  return cache_.value();
+}
+
+void Cell::FormulaImpl::EvictCache() const {
+  MemoryStats before = GetMemoryUsage();
+  evicted_ = cache_valid_;
+  cache_valid_ = false;
+  cache_.reset();
+  NoteMemoryChange(before);
+}
+
+MemoryStats Cell::FormulaImpl::GetMemoryUsage() const {
+  MemoryStats usage;
+  usage.cells.bytes = sizeof(*this);
+  usage.formulas.bytes = expression_.capacity() +
+                         referenced_cells_.capacity() * sizeof(Position) +
+                         sheet_references_.capacity() * sizeof(SheetPosition) +
+                         formula_bytes_;
+  usage.formulas.count = 1;
+  if (cache_) {
+    usage.cached_values = {sizeof(Value), 1};
+  }
+  return usage;
+}
+
+void Cell::FormulaImpl::NoteMemoryChange(const MemoryStats& before) const {
+  if (cell_.GetFormulaImpl() != this) {
+    return;
+  }
+  cell_.sheet_.RemoveMemoryUsage(before);
+  cell_.sheet_.AddMemoryUsage(GetMemoryUsage());
 }
 
 std::vector<Position> Cell::FormulaImpl::GetReferencedCells() const {
-  return formula_->GetReferencedCells();
+  return referenced_cells_;
 }
 
-void Cell::FormulaImpl::DeleteCache() { cache_.reset(); }
+void Cell::FormulaImpl::DeleteCache() {
+  cache_valid_ = false;
+  evicted_ = false;
+}
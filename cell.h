@@ -2,38 +2,166 @@
 
 #include "common.h"
 #include "formula.h"
+#include "memory_stats.h"
+#include "string_pool.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
 #include <optional>
 #include <set>
+#include <variant>
 
 class Sheet;
 
+// Ограничение на вычисление: срок и флаг отмены. Проверяется перед
+// вычислением каждой следующей ячейки, поэтому одна формула не прерывается.
+struct EvaluationLimit {
+  using Clock = std::chrono::steady_clock;
+
+  Clock::time_point deadline = Clock::time_point::max();
+  const std::atomic<bool>* cancelled = nullptr;
+
+  static EvaluationLimit Within(Clock::duration budget);
+  bool IsExpired() const;
+};
+
 class Cell : public CellInterface {
  public:
-  explicit Cell(Sheet& sheet);
+  Cell(Sheet& sheet, Position pos);
   ~Cell();
 
-  void CheckForCycles(std::vector<Position>, Cell* root);
+  // Ячейки других листов книги, на которые ссылается формула
+  using SheetReferences = std::vector<std::pair<const Sheet*, Position>>;
+
+  // Бросает CircularDependencyException, если ссылки на references этого
+  // листа и sheet_references других листов замкнут цикл через эту ячейку
+  void CheckForCycles(const std::vector<Position>& references,
+                      const SheetReferences& sheet_references = {}) const;
 
   void Set(std::string text);
   void Clear();
+  // Переносит содержимое и уже вычисленное значение ячейки из снимка
+  // родительской таблицы без проверки циклов и пересчёта зависимых
+  void Restore(const CellInterface& source);
+  void LinkReferencedCell(Cell* cell);
+  // Разрывает рёбра от зависимых ячеек перед удалением пустой ячейки и
+  // возвращает эти ячейки
+  std::vector<Cell*> UnlinkDependents();
+  // Ячейки, формулы которых ссылаются на эту
+  const std::set<Cell*>& GetDependentCells() const;
+  // Переносит ячейку на новую позицию при вставке и удалении строк и
+  // столбцов. Рёбра графа связывают сами ячейки и не меняются.
+  void MoveTo(Position pos);
+  // Заменяет в формуле ссылки на ячейки листа sheet на rewrite(pos) без
+  // повторного разбора и сбрасывает значение формулы
+  void RewriteReferences(const Sheet& sheet,
+                         const std::function<Position(Position)>& rewrite);
 
   Value GetValue() const override;
+  // Вычисляет значение ячейки, пока не истечёт limit. Позиции вычисленных
+  // по пути ячеек добавляются в settled. Возвращает true, если значение
+  // ячейки вычислено; иначе вычисленное сохраняется в кэше и следующий вызов
+  // продолжит с того же места.
+  bool Evaluate(const EvaluationLimit& limit,
+                std::vector<Position>* settled = nullptr) const;
+  // Последнее вычисленное значение, возможно устаревшее после правки
+  // аргументов. nullopt, если формула ещё ни разу не вычислялась.
+  std::optional<Value> GetLastValue() const;
   std::string GetText() const override;
+  // Текст и значение текстовой ячейки без копирования строки. nullopt для
+  // формулы: её текст собирается из AST, а значение вычисляется.
+  std::optional<std::string_view> GetTextView() const;
+  std::optional<std::string_view> GetTextValueView() const;
   std::vector<Position> GetReferencedCells() const override;
+  std::vector<SheetPosition> GetSheetReferences() const;
   bool IsReferenced() const;
+  bool IsEmpty() const;
+  // Известно ли значение ячейки без вычисления формулы
+  bool HasCachedValue() const;
+  // Хранит ли формула значение в памяти, пусть и устаревшее
+  bool HoldsFormulaValue() const;
+  // Освобождает память значения формулы. Актуальное значение считается
+  // вытесненным, а не устаревшим: зависимые ячейки остаются вычисленными,
+  // а само оно вычисляется заново при следующем чтении. Вызывается ValueCache.
+  void EvictValue() const;
+  Position GetPosition() const;
+  // Разбирает отложенную формулу, бросает FormulaException при ошибке
+  void Validate() const;
 
  private:
+  // Находит листы, на которые ссылается формула; бросает FormulaException,
+  // если такого листа в книге нет
+  SheetReferences ResolveSheetReferences(
+      const std::vector<SheetPosition>& references) const;
   void FillReferencedCells();
   void ClearReferencedCells();
   void DeleteCache() const;
+  bool EvaluateReferencedCells(const EvaluationLimit* limit = nullptr,
+                               std::vector<Position>* settled = nullptr) const;
+  std::optional<Value> GetCachedValue() const;
+  std::vector<Cell*> GetDependentsInTopologicalOrder();
+  void PropagateChange(const std::optional<Value>& old_value);
 
-  class Impl;
-  class EmptyImpl;
-  class TextImpl;
   class FormulaImpl;
-  
-  std::unique_ptr<Impl> impl_;
+
+  // Текст не длиннее указателя прямо в записи ячейки. std::string занял бы
+  // 32 байта даже пустым.
+  class ShortText {
+   public:
+    static constexpr size_t CAPACITY = sizeof(void*) - 1;
+
+    explicit ShortText(std::string_view text);
+    std::string_view Get() const;
+
+   private:
+    std::array<char, CAPACITY> data_;
+    uint8_t size_;
+  };
+
+  // Содержимое ячейки, выбор по тегу без виртуальных вызовов. Пустая ячейка
+  // и короткий текст хранятся прямо в ячейке, длинный текст - в пуле
+  // таблицы, формула - отдельным объектом: она держит AST и кэш значения.
+  using Content = std::variant<std::monostate, ShortText, StringPool::Ref,
+                               std::unique_ptr<FormulaImpl>>;
+
+  // Рёбра графа зависимостей. У большинства ячеек их нет, поэтому множества
+  // хранятся отдельно и создаются с первым ребром.
+  struct Links {
+    std::set<Cell*> dependent_cells;
+    std::set<Cell*> referensed_cells;
+  };
+
+  Content MakeTextContent(std::string text) const;
+  // Заменяет содержимое ячейки, перенося учёт памяти на новое
+  void ReplaceContent(Content content);
+  // Текст текстовой ячейки или nullopt
+  std::optional<std::string_view> GetStoredText() const;
+  // Формула ячейки или nullptr
+  FormulaImpl* GetFormulaImpl() const;
+  // Значение содержимого без вычисления аргументов формулы
+  Value GetContentValue() const;
+  // Значение соответствует текущим аргументам, хотя может быть вытеснено
+  bool IsCurrent() const;
+  void InvalidateValue() const;
+  // Память самой ячейки и её содержимого без рёбер графа
+  MemoryStats GetMemoryUsage() const;
+  MemoryStats GetContentMemoryUsage() const;
+  // Ячейки, на которые ссылается формула; пустое множество без рёбер
+  const std::set<Cell*>& GetReferencedCellSet() const;
+  // Рёбра ячейки, создаются при первом обращении
+  Links& GetLinks();
+  // Освобождает множества рёбер, если они опустели
+  void ReleaseEmptyLinks();
+
+  Content content_;
   Sheet& sheet_;
-  std::set<Cell*> dependent_cells_;  
-  std::set<Cell*> referensed_cells_;
+  Position pos_;
+  std::unique_ptr<Links> links_;
 };
+
+// Запись ячейки: указатель на таблицу виртуальных функций, содержимое,
+// таблица, позиция и рёбра
+static_assert(sizeof(Cell) <= 6 * sizeof(void*),
+              "Cell record must stay compact");
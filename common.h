@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <iosfwd>
 #include <memory>
 #include <stdexcept>
@@ -13,12 +15,18 @@ struct Position {
     int row = 0;
     int col = 0;
 
-    bool operator==(Position rhs) const;
-    bool operator<(Position rhs) const;
+    bool operator==(Position rhs) const {
+        return row == rhs.row && col == rhs.col;
+    }
+    bool operator<(Position rhs) const {
+        return row != rhs.row ? row < rhs.row : col < rhs.col;
+    }
 
     bool IsValid() const;
     std::string ToString() const;
 
+    // Разбирает запись вида A1 без выделения памяти. Возвращает NONE, если
+    // запись некорректна; позиция за пределами таблицы возвращается как есть.
     static Position FromString(std::string_view str);
 
     static const int MAX_ROWS = 16384;
@@ -26,6 +34,69 @@ struct Position {
     static const Position NONE;
 };
 
+// Корректная позиция, упакованная в 32 бита: строка в старших 16 битах,
+// столбец в младших. Ключи сравниваются одним числом в том же порядке, что
+// и позиции (по строкам), и годятся для хэш-таблиц и сериализации.
+class PositionKey {
+public:
+    constexpr PositionKey() = default;
+    constexpr explicit PositionKey(Position pos)
+        : value_(static_cast<uint32_t>(pos.row) << COL_BITS |
+                 static_cast<uint32_t>(pos.col)) {}
+
+    static constexpr PositionKey FromValue(uint32_t value) {
+        PositionKey key;
+        key.value_ = value;
+        return key;
+    }
+
+    constexpr uint32_t GetValue() const { return value_; }
+    constexpr Position ToPosition() const {
+        return {static_cast<int>(value_ >> COL_BITS),
+                static_cast<int>(value_ & COL_MASK)};
+    }
+    // Z-порядок: биты строки и столбца чередуются, и ячейки, близкие по
+    // обеим осям, получают близкие коды
+    uint32_t GetMortonCode() const;
+
+    constexpr bool operator==(PositionKey rhs) const {
+        return value_ == rhs.value_;
+    }
+    constexpr bool operator!=(PositionKey rhs) const {
+        return value_ != rhs.value_;
+    }
+    constexpr bool operator<(PositionKey rhs) const {
+        return value_ < rhs.value_;
+    }
+
+private:
+    static constexpr int COL_BITS = 16;
+    static constexpr uint32_t COL_MASK = (1u << COL_BITS) - 1;
+
+    uint32_t value_ = 0;
+};
+
+struct PositionKeyHasher {
+    size_t operator()(PositionKey key) const {
+        // Мультипликативное хэширование: соседние ключи расходятся по корзинам
+        return static_cast<size_t>(key.GetValue() * 0x9E3779B97F4A7C15ull >> 16);
+    }
+};
+
+// Ссылка на ячейку листа книги: Sheet2!A1. Имя листа состоит из латинских
+// букв, цифр и знака подчёркивания и не начинается с цифры.
+struct SheetPosition {
+    std::string sheet;
+    Position pos;
+
+    bool operator==(const SheetPosition& rhs) const;
+    bool operator<(const SheetPosition& rhs) const;
+
+    std::string ToString() const;
+
+    static bool IsValidSheetName(std::string_view name);
+};
+
 struct Size {
     int rows = 0;
     int cols = 0;
@@ -155,6 +226,13 @@ public:
     // соответственно. Пустая ячейка представляется пустой строкой в любом случае.
     virtual void PrintValues(std::ostream& output) const = 0;
     virtual void PrintTexts(std::ostream& output) const = 0;
+
+    // Возвращает лист той же книги с именем name либо nullptr, если такого
+    // листа нет или таблица не входит в книгу. Через него вычисляются ссылки
+    // вида Sheet2!A1.
+    virtual const SheetInterface* FindSheet(std::string_view name) const {
+        return nullptr;
+    }
 };
 
 // Создаёт готовую к работе пустую таблицу.
@@ -24,7 +24,11 @@ namespace {
 class Formula : public FormulaInterface {
 public:
 // Реализуйте следующие методы:
- explicit Formula(std::string expression):ast_(ParseFormulaAST(expression)){ 
+ explicit Formula(std::string expression, SharedSubexpressions* shared)
+     : ast_(ParseFormulaAST(expression)) {
+   if (shared) {
+     ast_.ShareSubexpressions(*shared);
+   }
  }
  Value Evaluate(const SheetInterface& sheet) const override {
    try {
@@ -45,19 +49,165 @@ public:
    std::vector<Position> result{cells_list.cbegin(), cells_list.cend()};
    auto last = std::unique(result.begin(), result.end());
    result.erase(last, result.end());
+   // удалённые ячейки (#REF!) стоят в начале отсортированного списка
+   auto deleted = std::find_if(result.begin(), result.end(),
+                               [](Position pos) { return pos.IsValid(); });
+   result.erase(result.begin(), deleted);
 
    return result;
  }
 
+ std::vector<SheetPosition> GetSheetReferences() const override {
+   const auto& cells_list = ast_.GetSheetCells();
+
+   std::vector<SheetPosition> result;
+   for (const SheetPosition& cell : cells_list) {
+     if (cell.pos.IsValid() && (result.empty() || !(result.back() == cell))) {
+       result.push_back(cell);
+     }
+   }
+
+   return result;
+ }
+
+ size_t GetMemoryUsage() const override {
+   return sizeof(*this) + ast_.GetMemoryUsage();
+ }
+
+ void RewriteReferences(const std::function<Position(Position)>& rewrite,
+                        bool local, std::string_view sheet) override {
+   ast_.RewriteCells(rewrite, local, sheet);
+ }
+
 private:
     FormulaAST ast_;
 };
 }  // namespace
 
-std::unique_ptr<FormulaInterface> ParseFormula(std::string expression) {
+std::unique_ptr<FormulaInterface> ParseFormula(std::string expression,
+                                               SharedSubexpressions* shared) {
   try {
-    return std::make_unique<Formula>(std::move(expression));
+    return std::make_unique<Formula>(std::move(expression), shared);
   } catch (...) {
     throw FormulaException("Parse error");
   }
+}
+
+namespace {
+bool IsDigit(char c) { return c >= '0' && c <= '9'; }
+bool IsUpper(char c) { return c >= 'A' && c <= 'Z'; }
+
+size_t SkipDigits(std::string_view str, size_t pos) {
+  while (pos < str.size() && IsDigit(str[pos])) {
+    ++pos;
+  }
+  return pos;
+}
+
+// Пропускает лексему NUMBER из Formula.g4, начинающуюся с pos. Экспонента
+// поглощается целиком, иначе в "1E5" нашлась бы ячейка E5.
+size_t SkipNumber(std::string_view str, size_t pos) {
+  pos = SkipDigits(str, pos);
+  if (pos < str.size() && str[pos] == '.') {
+    pos = SkipDigits(str, pos + 1);
+  }
+  if (pos < str.size() && (str[pos] == 'e' || str[pos] == 'E')) {
+    size_t exp = pos + 1;
+    if (exp < str.size() && (str[exp] == '+' || str[exp] == '-')) {
+      ++exp;
+    }
+    size_t exp_end = SkipDigits(str, exp);
+    if (exp_end != exp) {
+      pos = exp_end;
+    }
+  }
+  return pos;
+}
+}  // namespace
+
+namespace {
+// Так печатается ссылка на удалённую ячейку
+constexpr std::string_view DEAD_REFERENCE = "#REF!";
+
+bool IsNameChar(char c) {
+  return IsDigit(c) || IsUpper(c) || (c >= 'a' && c <= 'z') || c == '_';
+}
+
+// Лексема CELL или позиция после '!' в SHEET_CELL
+Position ParseCellToken(std::string_view token) {
+  size_t letters = 0;
+  while (letters < token.size() && IsUpper(token[letters])) {
+    ++letters;
+  }
+  if (letters == 0 || letters == token.size() ||
+      SkipDigits(token, letters) != token.size()) {
+    return Position::NONE;
+  }
+  Position cell = Position::FromString(token);
+  if (!cell.IsValid()) {
+    throw FormulaException("Invalid position: " + std::string(token));
+  }
+  return cell;
+}
+
+void ScanReferences(std::string_view expression, std::vector<Position>& cells,
+                    std::vector<SheetPosition>& sheet_cells) {
+  size_t pos = 0;
+  while (pos < expression.size()) {
+    char c = expression[pos];
+    if (IsDigit(c) || c == '.') {
+      pos = SkipNumber(expression, pos);
+    } else if (expression.substr(pos, DEAD_REFERENCE.size()) ==
+               DEAD_REFERENCE) {
+      // Ссылка на удалённую ячейку никуда не ведёт; без этой ветки "REF!"
+      // читался бы как ссылка на лист REF
+      pos += DEAD_REFERENCE.size();
+    } else if (IsNameChar(c)) {
+      size_t start = pos;
+      while (pos < expression.size() && IsNameChar(expression[pos])) {
+        ++pos;
+      }
+      auto token = expression.substr(start, pos - start);
+      if (pos < expression.size() && expression[pos] == '!') {
+        size_t cell_start = ++pos;
+        while (pos < expression.size() && IsNameChar(expression[pos])) {
+          ++pos;
+        }
+        auto cell_token = expression.substr(cell_start, pos - cell_start);
+        Position cell = ParseCellToken(cell_token);
+        if (!cell.IsValid()) {
+          throw FormulaException("Invalid position: " +
+                                 std::string(cell_token));
+        }
+        sheet_cells.push_back({std::string(token), cell});
+      } else if (Position cell = ParseCellToken(token); cell.IsValid()) {
+        cells.push_back(cell);
+      }
+    } else {
+      ++pos;
+    }
+  }
+}
+
+template <typename T>
+void SortUnique(std::vector<T>& values) {
+  std::sort(values.begin(), values.end());
+  values.erase(std::unique(values.begin(), values.end()), values.end());
+}
+}  // namespace
+
+std::vector<Position> ScanFormulaReferences(std::string_view expression) {
+  std::vector<Position> cells;
+  std::vector<SheetPosition> sheet_cells;
+  ScanReferences(expression, cells, sheet_cells);
+  SortUnique(cells);
+  return cells;
+}
+
+std::vector<SheetPosition> ScanSheetReferences(std::string_view expression) {
+  std::vector<Position> cells;
+  std::vector<SheetPosition> sheet_cells;
+  ScanReferences(expression, cells, sheet_cells);
+  SortUnique(sheet_cells);
+  return sheet_cells;
 }
\ No newline at end of file
@@ -2,9 +2,17 @@
 
 #include "common.h"
 
+#include <cstdint>
+#include <functional>
 #include <memory>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
+namespace ASTImpl {
+class SharedNode;
+}
+
 // Формула, позволяющая вычислять и обновлять арифметическое выражение.
 // Поддерживаемые возможности:
 // * Простые бинарные операции и числа, скобки: 1+2*3, 2.5*(2+3.5/7)
@@ -34,10 +42,71 @@ public:
         // формулы. Список отсортирован по возрастанию и не содержит повторяющихся
         // ячеек.
         virtual std::vector<Position> GetReferencedCells() const = 0;
+
+        // Возвращает ссылки на ячейки других листов книги (Sheet2!A1).
+        // Список отсортирован по возрастанию и не содержит повторов.
+        virtual std::vector<SheetPosition> GetSheetReferences() const = 0;
+
+        // Оценка памяти, занимаемой формулой вместе с AST, в байтах.
+        virtual size_t GetMemoryUsage() const = 0;
+
+        // Заменяет позиции ячеек в ссылках формулы на rewrite(pos) без
+        // повторного разбора: ссылки на свой лист, если local, и ссылки на
+        // лист с именем sheet, если оно не пустое. Ссылка, для которой
+        // rewrite вернул некорректную позицию, становится #REF! и пропадает
+        // из GetReferencedCells() и GetSheetReferences().
+        virtual void RewriteReferences(
+                const std::function<Position(Position)>& rewrite, bool local,
+                std::string_view sheet) = 0;
 };
 
-// Парсит переданное выражение и возвращает объект формулы.
+// Общие подвыражения формул одной таблицы. Одинаковые части формул, которые
+// ссылаются только на ячейки этой таблицы, например (B1*C1+D1), хранятся
+// одним узлом AST. Его значение вычисляется один раз за эпоху: таблица
+// начинает новую, когда значение какой-то её ячейки может измениться.
+class SharedSubexpressions {
+public:
+        SharedSubexpressions() = default;
+        SharedSubexpressions(const SharedSubexpressions&) = delete;
+        SharedSubexpressions& operator=(const SharedSubexpressions&) = delete;
+        ~SharedSubexpressions();
+
+        // Сбрасывает значения всех общих подвыражений
+        void NextEpoch() { ++epoch_; }
+        uint64_t GetEpoch() const { return epoch_; }
+
+        // Число общих подвыражений в формулах
+        size_t GetSize() const { return nodes_.size(); }
+        // Сколько раз значение подвыражения взято из кэша
+        size_t GetHitCount() const { return hits_; }
+
+        // Заменяет позиции ячеек в общих подвыражениях на rewrite(pos), как
+        // FormulaInterface::RewriteReferences. Подвыражения, ставшие
+        // одинаковыми, остаются разными узлами.
+        void RewriteCells(const std::function<Position(Position)>& rewrite);
+
+private:
+        friend class ASTImpl::SharedNode;
+
+        // Ключ - запись подвыражения в префиксной форме. Повторы возможны
+        // только после RewriteCells.
+        std::unordered_multimap<std::string, ASTImpl::SharedNode*> nodes_;
+        uint64_t epoch_ = 0;
+        size_t hits_ = 0;
+};
+
+// Парсит переданное выражение и возвращает объект формулы. Если передан пул
+// shared, общие подвыражения формулы берутся из него.
 // Бросает FormulaException в случае, если формула синтаксически некорректна.
-std::unique_ptr<FormulaInterface> ParseFormula(std::string expression);
+std::unique_ptr<FormulaInterface> ParseFormula(
+        std::string expression, SharedSubexpressions* shared = nullptr);
+
+// Быстро находит ячейки, на которые ссылается выражение, не строя AST.
+// Результат совпадает с GetReferencedCells() разобранной формулы: отсортирован
+// по возрастанию и не содержит повторов. Синтаксис выражения не проверяется,
+// но для некорректной позиции бросается FormulaException, как и при разборе.
+std::vector<Position> ScanFormulaReferences(std::string_view expression);
+// То же для ссылок на другие листы; совпадает с GetSheetReferences()
+std::vector<SheetPosition> ScanSheetReferences(std::string_view expression);
 
 std::ostream& operator<<(std::ostream& output, const CellInterface::Value& val);
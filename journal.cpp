@@ -0,0 +1,324 @@
+#include "journal.h"
+
+#include "sheet.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+const std::string JOURNAL_MAGIC = "ETJ1";
+
+enum RecordType : uint8_t {
+  RT_SET = 1,
+  RT_CLEAR = 2,
+  RT_INSERT_ROWS = 3,
+  RT_INSERT_COLUMNS = 4,
+  RT_DELETE_ROWS = 5,
+  RT_DELETE_COLUMNS = 6,
+};
+
+// тип (1) + строка (2) + столбец (2) + длина текста (4). У вставки и
+// удаления в поле строки первая строка (столбец), в поле столбца - их число.
+const size_t RECORD_HEADER_SIZE = 9;
+const size_t RECORD_CHECKSUM_SIZE = 4;
+
+void PutUint(std::string& out, uint32_t value, int bytes) {
+  for (int i = 0; i < bytes; ++i) {
+    out.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+  }
+}
+
+uint32_t GetUint(const std::string& in, size_t offset, int bytes) {
+  uint32_t value = 0;
+  for (int i = 0; i < bytes; ++i) {
+    value |= static_cast<uint32_t>(static_cast<uint8_t>(in[offset + i]))
+             << (8 * i);
+  }
+  return value;
+}
+
+// FNV-1a, чтобы отличать целую запись от недописанной
+uint32_t Checksum(const std::string& data, size_t begin, size_t end) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = begin; i < end; ++i) {
+    hash ^= static_cast<uint8_t>(data[i]);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+std::string EncodeRecord(RecordType type, Position pos,
+                         const std::string& text) {
+  std::string record;
+  record.reserve(RECORD_HEADER_SIZE + text.size() + RECORD_CHECKSUM_SIZE);
+  PutUint(record, type, 1);
+  PutUint(record, static_cast<uint32_t>(pos.row), 2);
+  PutUint(record, static_cast<uint32_t>(pos.col), 2);
+  PutUint(record, static_cast<uint32_t>(text.size()), 4);
+  record += text;
+  PutUint(record, Checksum(record, 0, record.size()), 4);
+  return record;
+}
+
+bool IsValidRecord(RecordType type, Position pos) {
+  switch (type) {
+    case RT_SET:
+    case RT_CLEAR:
+      return pos.IsValid();
+    case RT_INSERT_ROWS:
+    case RT_DELETE_ROWS:
+      return pos.row < Position::MAX_ROWS && pos.col > 0 &&
+             pos.col <= Position::MAX_ROWS;
+    case RT_INSERT_COLUMNS:
+    case RT_DELETE_COLUMNS:
+      return pos.row < Position::MAX_COLS && pos.col > 0 &&
+             pos.col <= Position::MAX_COLS;
+  }
+  return false;
+}
+
+// Разбирает записи из data и возвращает длину целого префикса файла.
+// Всё, что после него, считается недописанным хвостом.
+size_t DecodeRecords(
+    const std::string& data,
+    const std::function<void(RecordType, Position, std::string)>& handler) {
+  if (data.compare(0, JOURNAL_MAGIC.size(), JOURNAL_MAGIC) != 0) {
+    if (data.size() < JOURNAL_MAGIC.size() &&
+        JOURNAL_MAGIC.compare(0, data.size(), data) == 0) {
+      return 0;
+    }
+    throw JournalException("Not a journal file");
+  }
+
+  size_t offset = JOURNAL_MAGIC.size();
+  while (offset + RECORD_HEADER_SIZE <= data.size()) {
+    auto type = static_cast<RecordType>(GetUint(data, offset, 1));
+    Position pos{static_cast<int>(GetUint(data, offset + 1, 2)),
+                 static_cast<int>(GetUint(data, offset + 3, 2))};
+    size_t length = GetUint(data, offset + 5, 4);
+    size_t text_begin = offset + RECORD_HEADER_SIZE;
+    if (length > data.size() - text_begin ||
+        data.size() - text_begin - length < RECORD_CHECKSUM_SIZE) {
+      break;
+    }
+    size_t text_end = text_begin + length;
+    if (GetUint(data, text_end, 4) != Checksum(data, offset, text_end) ||
+        !IsValidRecord(type, pos)) {
+      break;
+    }
+    handler(type, pos, data.substr(text_begin, length));
+    offset = text_end + RECORD_CHECKSUM_SIZE;
+  }
+  return offset;
+}
+
+std::string ReadFile(const std::string& path) {
+  std::error_code error;
+  if (!std::filesystem::is_regular_file(path, error)) {
+    return {};
+  }
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    return {};
+  }
+  return {std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+}
+
+void SyncFile(std::FILE* file) {
+  if (std::fflush(file) != 0) {
+    throw JournalException("Failed to flush journal");
+  }
+#ifdef _WIN32
+  int result = _commit(_fileno(file));
+#else
+  int result = fsync(fileno(file));
+#endif
+  if (result != 0) {
+    throw JournalException("Failed to sync journal");
+  }
+}
+}  // namespace
+
+ChangeJournal::ChangeJournal(std::string path)
+    : ChangeJournal(std::move(path), Options{}) {}
+
+ChangeJournal::ChangeJournal(std::string path, Options options)
+    : path_(std::move(path)), options_(options) {
+  Open();
+}
+
+ChangeJournal::~ChangeJournal() {
+  if (file_) {
+    try {
+      Sync();
+    } catch (const JournalException&) {
+    }
+    std::fclose(file_);
+  }
+}
+
+void ChangeJournal::Open() {
+  std::string data = ReadFile(path_);
+  size_t valid_size = 0;
+  if (!data.empty()) {
+    valid_size = DecodeRecords(data, [](RecordType, Position, std::string) {});
+  }
+  if (valid_size < data.size()) {
+    std::filesystem::resize_file(path_, valid_size);
+  }
+
+  file_ = std::fopen(path_.c_str(), "ab");
+  if (!file_) {
+    throw JournalException("Failed to open journal " + path_);
+  }
+  if (valid_size == 0) {
+    std::fwrite(JOURNAL_MAGIC.data(), 1, JOURNAL_MAGIC.size(), file_);
+    SyncFile(file_);
+  }
+  pending_ops_ = 0;
+  last_sync_ = std::chrono::steady_clock::now();
+}
+
+void ChangeJournal::Append(const std::string& record) {
+  if (!file_) {
+    throw JournalException("Journal " + path_ + " is not open");
+  }
+  if (std::fwrite(record.data(), 1, record.size(), file_) != record.size()) {
+    throw JournalException("Failed to write journal");
+  }
+  ++pending_ops_;
+  if (pending_ops_ >= options_.sync_every_ops ||
+      std::chrono::steady_clock::now() - last_sync_ >= options_.sync_interval) {
+    Sync();
+  }
+}
+
+void ChangeJournal::LogSet(Position pos, const std::string& text) {
+  Append(EncodeRecord(RT_SET, pos, text));
+}
+
+void ChangeJournal::LogClear(Position pos) {
+  Append(EncodeRecord(RT_CLEAR, pos, {}));
+}
+
+void ChangeJournal::LogInsertRows(int before, int count) {
+  Append(EncodeRecord(RT_INSERT_ROWS, {before, count}, {}));
+}
+
+void ChangeJournal::LogInsertColumns(int before, int count) {
+  Append(EncodeRecord(RT_INSERT_COLUMNS, {before, count}, {}));
+}
+
+void ChangeJournal::LogDeleteRows(int first, int count) {
+  Append(EncodeRecord(RT_DELETE_ROWS, {first, count}, {}));
+}
+
+void ChangeJournal::LogDeleteColumns(int first, int count) {
+  Append(EncodeRecord(RT_DELETE_COLUMNS, {first, count}, {}));
+}
+
+void ChangeJournal::Sync() {
+  if (!file_) {
+    throw JournalException("Journal " + path_ + " is not open");
+  }
+  SyncFile(file_);
+  pending_ops_ = 0;
+  last_sync_ = std::chrono::steady_clock::now();
+}
+
+bool ChangeJournal::SyncIfDue() {
+  if (pending_ops_ == 0 ||
+      std::chrono::steady_clock::now() - last_sync_ < options_.sync_interval) {
+    return false;
+  }
+  Sync();
+  return true;
+}
+
+void ChangeJournal::Compact(const SheetInterface& sheet) {
+  std::string snapshot = JOURNAL_MAGIC;
+  Size size = sheet.GetPrintableSize();
+  for (int row = 0; row < size.rows; ++row) {
+    for (int col = 0; col < size.cols; ++col) {
+      const CellInterface* cell = sheet.GetCell({row, col});
+      if (!cell) {
+        continue;
+      }
+      std::string text = cell->GetText();
+      if (!text.empty()) {
+        snapshot += EncodeRecord(RT_SET, {row, col}, text);
+      }
+    }
+  }
+
+  std::string tmp_path = path_ + ".tmp";
+  std::FILE* tmp = std::fopen(tmp_path.c_str(), "wb");
+  if (!tmp) {
+    throw JournalException("Failed to create " + tmp_path);
+  }
+  bool written =
+      std::fwrite(snapshot.data(), 1, snapshot.size(), tmp) == snapshot.size();
+  try {
+    SyncFile(tmp);
+  } catch (const JournalException&) {
+    written = false;
+  }
+  std::fclose(tmp);
+  if (!written) {
+    throw JournalException("Failed to write " + tmp_path);
+  }
+
+  Sync();
+  std::fclose(file_);
+  file_ = nullptr;
+  std::error_code error;
+  std::filesystem::rename(tmp_path, path_, error);
+  if (error) {
+    // Старый журнал остался на месте, снова открываем его для записи
+    std::filesystem::remove(tmp_path, error);
+    Open();
+    throw JournalException("Failed to replace " + path_);
+  }
+  Open();
+}
+
+size_t ChangeJournal::Replay(const std::string& path, Sheet& sheet) {
+  size_t count = 0;
+  std::string data = ReadFile(path);
+  if (data.empty()) {
+    return count;
+  }
+  DecodeRecords(data, [&](RecordType type, Position pos, std::string text) {
+    switch (type) {
+      case RT_SET:
+        sheet.SetCell(pos, std::move(text));
+        break;
+      case RT_CLEAR:
+        sheet.ClearCell(pos);
+        break;
+      case RT_INSERT_ROWS:
+        sheet.InsertRows(pos.row, pos.col);
+        break;
+      case RT_INSERT_COLUMNS:
+        sheet.InsertColumns(pos.row, pos.col);
+        break;
+      case RT_DELETE_ROWS:
+        sheet.DeleteRows(pos.row, pos.col);
+        break;
+      case RT_DELETE_COLUMNS:
+        sheet.DeleteColumns(pos.row, pos.col);
+        break;
+    }
+    ++count;
+  });
+  return count;
+}
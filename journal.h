@@ -0,0 +1,69 @@
+#pragma once
+
+#include "common.h"
+
+#include <chrono>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+
+class Sheet;
+
+// Исключение, выбрасываемое при ошибке чтения или записи журнала
+class JournalException : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// Журнал изменений таблицы (write-ahead log). Каждая успешная операция
+// SetCell/ClearCell, вставка и удаление строк и столбцов дописывается в конец
+// двоичного файла. Записи сбрасываются на диск группами: fsync выполняется
+// после sync_every_ops операций или если с прошлой синхронизации прошло больше
+// sync_interval. Своего таймера у журнала нет, срок проверяется только при
+// записи, поэтому во время простоя владелец должен периодически вызывать
+// SyncIfDue() (или Sync()), иначе последние записи останутся несброшенными.
+// Повреждённый хвост файла (например, после аварийного завершения посреди
+// записи) при открытии отбрасывается.
+class ChangeJournal {
+ public:
+  struct Options {
+    size_t sync_every_ops = 64;
+    std::chrono::milliseconds sync_interval{50};
+  };
+
+  explicit ChangeJournal(std::string path);
+  ChangeJournal(std::string path, Options options);
+  ChangeJournal(const ChangeJournal&) = delete;
+  ChangeJournal& operator=(const ChangeJournal&) = delete;
+  ~ChangeJournal();
+
+  void LogSet(Position pos, const std::string& text);
+  void LogClear(Position pos);
+  void LogInsertRows(int before, int count);
+  void LogInsertColumns(int before, int count);
+  void LogDeleteRows(int first, int count);
+  void LogDeleteColumns(int first, int count);
+
+  // Сбрасывает накопленные записи на диск
+  void Sync();
+  // Сбрасывает накопленные записи, если с прошлой синхронизации прошло больше
+  // sync_interval. Возвращает true, если синхронизация была выполнена.
+  bool SyncIfDue();
+
+  // Заменяет журнал снимком текущего содержимого таблицы: по одной записи
+  // SetCell на каждую непустую ячейку. Старый файл подменяется атомарно.
+  void Compact(const SheetInterface& sheet);
+
+  // Применяет к таблице все целые записи журнала. Возвращает их количество.
+  static size_t Replay(const std::string& path, Sheet& sheet);
+
+ private:
+  void Open();
+  void Append(const std::string& record);
+
+  std::string path_;
+  Options options_;
+  std::FILE* file_ = nullptr;
+  size_t pending_ops_ = 0;
+  std::chrono::steady_clock::time_point last_sync_;
+};
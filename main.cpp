@@ -1,7 +1,18 @@
 #include "common.h"
 #include "formula.h"
+#include "async_sheet.h"
+#include "calc_server.h"
+#include "sheet.h"
+#include "sweep.h"
+#include "tracing.h"
+#include "workbook.h"
 #include "test_runner_p.h"
 
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+
 inline std::ostream& operator<<(std::ostream& output, Position pos) {
     return output << "(" << pos.row << ", " << pos.col << ")";
 }
@@ -287,6 +298,12 @@ void TestPrint() {
     std::ostringstream values;
     sheet->PrintValues(values);
     ASSERT_EQUAL(values.str(), "\t\nmeow\t35\n");
+
+    // Пустая ячейка таблицы печатается своим значением, как и раньше
+    sheet->SetCell("A1"_pos, "");
+    std::ostringstream empty_values;
+    sheet->PrintValues(empty_values);
+    ASSERT_EQUAL(empty_values.str(), "0\t\nmeow\t35\n");
 }
 
 void TestCellReferences() {
@@ -384,6 +401,1392 @@ void TestExtra() {
   ASSERT_EQUAL(sheet->GetCell("A4"_pos)->GetValue(), CellInterface::Value(0.0));
 
 }
+
+void TestScanFormulaReferences() {
+  ASSERT(ScanFormulaReferences("1e5+2E-3+.5E2").empty());
+  ASSERT_EQUAL(ScanFormulaReferences("B2 + A1*(A1 - 1E2) / ZZ10"),
+               (std::vector{"A1"_pos, "B2"_pos, "ZZ10"_pos}));
+  ASSERT_EQUAL(ScanFormulaReferences("A1 + A2 + A1 + A3 + A1 + A2 + A1"),
+               ParseFormula("A1 + A2 + A1 + A3 + A1 + A2 + A1")->GetReferencedCells());
+
+  bool caught = false;
+  try {
+    ScanFormulaReferences("A1+XFD16385");
+  } catch (const FormulaException&) {
+    caught = true;
+  }
+  ASSERT(caught);
+}
+
+void TestDeferredFormulaParsing() {
+  Sheet sheet;
+  sheet.SetDeferredParsing(true);
+
+  sheet.SetCell("A1"_pos, "=B1 + 1");
+  sheet.SetCell("B1"_pos, "2");
+  ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetReferencedCells(), std::vector{"B1"_pos});
+  ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetValue(), CellInterface::Value(3.0));
+  ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetText(), "=B1+1");
+
+  bool caught = false;
+  try {
+    sheet.SetCell("B1"_pos, "=A1*2");
+  } catch (const CircularDependencyException&) {
+    caught = true;
+  }
+  ASSERT(caught);
+
+  caught = false;
+  try {
+    sheet.SetCell("C1"_pos, "=X0+1");
+  } catch (const FormulaException&) {
+    caught = true;
+  }
+  ASSERT(caught);
+
+  sheet.SetCell("C1"_pos, "=(A1+");
+  ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetText(), "=(A1+");
+  caught = false;
+  try {
+    sheet.ValidateFormulas();
+  } catch (const FormulaException&) {
+    caught = true;
+  }
+  ASSERT(caught);
+
+  sheet.SetCell("C1"_pos, "=A1*2");
+  sheet.ValidateFormulas();
+  ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetValue(), CellInterface::Value(6.0));
+}
+
+void TestChangeJournalReplay() {
+  const std::string path =
+      (std::filesystem::temp_directory_path() / "etable_test_journal.bin").string();
+  std::filesystem::remove(path);
+
+  auto print_texts = [](const SheetInterface& sheet) {
+    std::ostringstream out;
+    sheet.PrintTexts(out);
+    return out.str();
+  };
+
+  std::string expected;
+  {
+    ChangeJournal journal(path, {3, std::chrono::milliseconds(1000)});
+    Sheet sheet;
+    sheet.AttachJournal(&journal);
+    sheet.SetCell("A1"_pos, "1");
+    sheet.SetCell("B1"_pos, "=A1+1");
+    sheet.SetCell("C1"_pos, "temp");
+    try {
+      sheet.SetCell("A1"_pos, "=B1");
+    } catch (const CircularDependencyException&) {
+    }
+    sheet.ClearCell("C1"_pos);
+    sheet.SetCell("A2"_pos, "'=text");
+    expected = print_texts(sheet);
+  }
+
+  {
+    Sheet restored;
+    ASSERT_EQUAL(ChangeJournal::Replay(path, restored), 5u);
+    ASSERT_EQUAL(print_texts(restored), expected);
+
+    ChangeJournal journal(path);
+    journal.Compact(restored);
+  }
+
+  {
+    // Недописанная запись в конце журнала игнорируется
+    std::ofstream out(path, std::ios::binary | std::ios::app);
+    out << "\x01\x02";
+  }
+
+  Sheet restored;
+  ASSERT_EQUAL(ChangeJournal::Replay(path, restored), 3u);
+  ASSERT_EQUAL(print_texts(restored), expected);
+
+  {
+    ChangeJournal journal(path);
+    restored.AttachJournal(&journal);
+    restored.SetCell("B2"_pos, "=B1*10");
+  }
+  Sheet appended;
+  ASSERT_EQUAL(ChangeJournal::Replay(path, appended), 4u);
+  ASSERT_EQUAL(appended.GetCell("B2"_pos)->GetValue(), CellInterface::Value(20.0));
+
+  // Вставка и удаление строк и столбцов дописываются и воспроизводятся
+  {
+    ChangeJournal journal(path);
+    appended.AttachJournal(&journal);
+    appended.InsertColumns(0, 2);
+    appended.InsertRows(1);
+    appended.DeleteRows(0);
+    appended.DeleteColumns(1);
+    appended.AttachJournal(nullptr);
+    expected = print_texts(appended);
+  }
+  Sheet shifted;
+  ASSERT_EQUAL(ChangeJournal::Replay(path, shifted), 8u);
+  ASSERT_EQUAL(print_texts(shifted), expected);
+
+  // Записи перед простоем сбрасываются по сроку без новых операций
+  {
+    ChangeJournal journal(path, {1000, std::chrono::milliseconds(1)});
+    ASSERT(!journal.SyncIfDue());
+    journal.LogSet("D1"_pos, "idle");
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    ASSERT(journal.SyncIfDue());
+    ASSERT(!journal.SyncIfDue());
+    Sheet synced;
+    ASSERT_EQUAL(ChangeJournal::Replay(path, synced), 9u);
+  }
+
+  // Неудачная подмена файла при сжатии не оставляет журнал в неопределённом
+  // состоянии: следующая запись сообщает об ошибке, а не падает
+  {
+    ChangeJournal journal(path);
+    std::filesystem::remove(path);
+    std::filesystem::create_directories(std::filesystem::path(path) / "blocker");
+    bool thrown = false;
+    try {
+      journal.Compact(shifted);
+    } catch (const JournalException&) {
+      thrown = true;
+    }
+    ASSERT(thrown);
+    thrown = false;
+    try {
+      journal.LogClear("A1"_pos);
+    } catch (const JournalException&) {
+      thrown = true;
+    }
+    ASSERT(thrown);
+    std::filesystem::remove_all(path);
+  }
+
+  std::filesystem::remove(path);
+}
+
+void TestChangeFeed() {
+  Sheet sheet;
+  sheet.SetChangeTracking(true);
+
+  sheet.SetCell("A1"_pos, "1");
+  sheet.SetCell("B1"_pos, "=A1*0");
+  sheet.SetCell("C1"_pos, "=A1+1");
+  ASSERT_EQUAL(sheet.TakeChanges(), (std::vector{"A1"_pos, "B1"_pos, "C1"_pos}));
+  ASSERT(sheet.TakeChanges().empty());
+
+  sheet.GetCell("B1"_pos)->GetValue();
+  sheet.GetCell("C1"_pos)->GetValue();
+  sheet.SetCell("A1"_pos, "2");
+  sheet.SetCell("A1"_pos, "3");
+  ASSERT_EQUAL(sheet.TakeChanges(), (std::vector{"A1"_pos, "C1"_pos}));
+
+  sheet.SetCell("A1"_pos, "4");
+  sheet.SetCell("A1"_pos, "3");
+  ASSERT(sheet.TakeChanges().empty());
+
+  sheet.ClearCell("A1"_pos);
+  ASSERT_EQUAL(sheet.TakeChanges(), (std::vector{"A1"_pos, "C1"_pos}));
+  ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetValue(), CellInterface::Value(1.0));
+
+  sheet.ClearCell("C1"_pos);
+  ASSERT(sheet.GetCell("C1"_pos) == nullptr);
+  ASSERT_EQUAL(sheet.TakeChanges(), std::vector{"C1"_pos});
+
+  // При немедленном пересчёте формула, не вычисленная до включения ленты,
+  // считается изменённой; вычисленная заранее - нет
+  for (bool evaluate_first : {false, true}) {
+    Sheet late;
+    late.SetCell("A1"_pos, "1");
+    late.SetCell("B1"_pos, "=A1*0");
+    late.SetEagerRecalculation(true);
+    if (evaluate_first) {
+      late.GetCell("B1"_pos)->GetValue();
+    }
+    late.SetChangeTracking(true);
+    late.SetCell("A1"_pos, "2");
+    std::vector<Position> expected = {"A1"_pos};
+    if (!evaluate_first) {
+      expected.push_back("B1"_pos);
+    }
+    ASSERT_EQUAL(late.TakeChanges(), expected);
+  }
+
+  // Позиции пакета могут оказаться за пределами таблицы после удаления строк
+  Sheet shrunk;
+  shrunk.SetChangeTracking(true);
+  shrunk.SetCell("A1"_pos, "1");
+  shrunk.SetCell("A9"_pos, "2");
+  shrunk.DeleteRows(0, 9);
+  ASSERT_EQUAL(shrunk.TakeChanges(), (std::vector{"A1"_pos, "A9"_pos}));
+}
+
+void TestEagerRecalculationEarlyCutoff() {
+  Sheet sheet;
+  sheet.SetEagerRecalculation(true);
+  sheet.SetCell("A1"_pos, "=1+1");
+  sheet.SetCell("B1"_pos, "=A1*0");
+  sheet.SetCell("C1"_pos, "=B1+A2");
+  sheet.SetCell("D1"_pos, "=A1*2");
+  sheet.SetCell("E1"_pos, "=D1+C1");
+  ASSERT_EQUAL(sheet.GetCell("E1"_pos)->GetValue(), CellInterface::Value(4.0));
+
+  sheet.SetChangeTracking(true);
+  sheet.SetCell("A1"_pos, "=2");
+  ASSERT(sheet.TakeChanges().empty());
+
+  sheet.SetCell("A1"_pos, "5");
+  ASSERT_EQUAL(sheet.TakeChanges(), (std::vector{"A1"_pos, "D1"_pos, "E1"_pos}));
+  ASSERT_EQUAL(sheet.GetCell("E1"_pos)->GetValue(), CellInterface::Value(10.0));
+
+  sheet.SetCell("A2"_pos, "1");
+  ASSERT_EQUAL(sheet.TakeChanges(), (std::vector{"C1"_pos, "E1"_pos, "A2"_pos}));
+  ASSERT_EQUAL(sheet.GetCell("E1"_pos)->GetValue(), CellInterface::Value(11.0));
+
+  sheet.ClearCell("A1"_pos);
+  ASSERT_EQUAL(sheet.GetCell("E1"_pos)->GetValue(), CellInterface::Value(1.0));
+}
+
+void TestDeepChainEvaluation() {
+  // Цепочка длиннее, чем позволил бы стек при рекурсивном вычислении
+  const int length = 50000;
+  auto chain_pos = [](int i) {
+    return Position{i % Position::MAX_ROWS, i / Position::MAX_ROWS};
+  };
+
+  Sheet sheet;
+  sheet.SetCell(chain_pos(0), "1");
+  for (int i = 1; i < length; ++i) {
+    sheet.SetCell(chain_pos(i), "=" + chain_pos(i - 1).ToString() + "+1");
+  }
+  const CellInterface* last = sheet.GetCell(chain_pos(length - 1));
+  ASSERT_EQUAL(last->GetValue(), CellInterface::Value(double(length)));
+
+  sheet.SetCell(chain_pos(0), "2");
+  ASSERT_EQUAL(last->GetValue(), CellInterface::Value(double(length + 1)));
+
+  bool caught = false;
+  try {
+    sheet.SetCell(chain_pos(0), "=" + chain_pos(length - 1).ToString());
+  } catch (const CircularDependencyException&) {
+    caught = true;
+  }
+  ASSERT(caught);
+}
+
+void TestSheetSnapshots() {
+  Sheet sheet;
+  sheet.SetCell("A1"_pos, "1");
+  sheet.SetCell("B1"_pos, "=A1*2");
+  sheet.SetCell("A3"_pos, "=C7");
+  sheet.SetCell("A5"_pos, "static");
+
+  auto first = sheet.Snapshot();
+  ASSERT_EQUAL(first->GetCell("B1"_pos)->GetValue(), CellInterface::Value(2.0));
+  ASSERT(first->GetCell("C7"_pos) == nullptr);
+  ASSERT(sheet.Snapshot() == first);
+
+  sheet.SetCell("A1"_pos, "5");
+  auto second = sheet.Snapshot();
+  ASSERT_EQUAL(first->GetCell("B1"_pos)->GetValue(), CellInterface::Value(2.0));
+  ASSERT_EQUAL(second->GetCell("B1"_pos)->GetValue(), CellInterface::Value(10.0));
+  ASSERT_EQUAL(second->GetVersion(), sheet.GetVersion());
+  // Неизменившиеся строки разделяются между версиями
+  ASSERT(first->GetRows()[4] == second->GetRows()[4]);
+  ASSERT(first->GetRows()[0] != second->GetRows()[0]);
+
+  std::ostringstream sheet_values;
+  std::ostringstream snapshot_values;
+  sheet.PrintValues(sheet_values);
+  second->PrintValues(snapshot_values);
+  ASSERT_EQUAL(snapshot_values.str(), sheet_values.str());
+
+  // Читатели видят только согласованные версии, пока писатель правит таблицу
+  std::atomic<bool> done = false;
+  std::atomic<int> inconsistent = 0;
+  std::thread reader([&] {
+    while (!done) {
+      auto snapshot = sheet.GetPublishedSnapshot();
+      auto a1 = std::stod(snapshot->GetCell("A1"_pos)->GetText());
+      auto b1 = std::get<double>(snapshot->GetCell("B1"_pos)->GetValue());
+      if (b1 != a1 * 2) {
+        ++inconsistent;
+      }
+    }
+  });
+  for (int i = 0; i < 2000; ++i) {
+    sheet.SetCell("A1"_pos, std::to_string(i));
+    sheet.Snapshot();
+  }
+  done = true;
+  reader.join();
+  ASSERT_EQUAL(inconsistent.load(), 0);
+}
+
+void TestSheetFork() {
+  auto value = [](const SheetInterface& sheet, Position pos) {
+    return sheet.GetCell(pos)->GetValue();
+  };
+
+  Sheet sheet;
+  sheet.SetCell("A1"_pos, "1");
+  sheet.SetCell("B1"_pos, "=A1*2");
+  sheet.SetCell("C1"_pos, "=B1+1");
+  sheet.SetCell("D1"_pos, "10");
+  sheet.SetCell("E1"_pos, "text");
+
+  auto fork = sheet.Fork();
+  ASSERT_EQUAL(value(*fork, "C1"_pos), CellInterface::Value(3.0));
+  ASSERT_EQUAL(fork->GetPrintableSize(), (Size{1, 5}));
+
+  // Правка копии пересчитывает зависимые ячейки и не видна родителю
+  fork->SetCell("A1"_pos, "5");
+  ASSERT_EQUAL(value(*fork, "C1"_pos), CellInterface::Value(11.0));
+  ASSERT_EQUAL(value(sheet, "C1"_pos), CellInterface::Value(3.0));
+
+  // И наоборот
+  sheet.SetCell("D1"_pos, "20");
+  ASSERT_EQUAL(fork->GetCell("D1"_pos)->GetText(), "10");
+
+  // Формула копии ссылается на ячейку, которая пока читается из снимка
+  fork->SetCell("F1"_pos, "=D1*2");
+  ASSERT_EQUAL(value(*fork, "F1"_pos), CellInterface::Value(20.0));
+  fork->SetCell("D1"_pos, "7");
+  ASSERT_EQUAL(value(*fork, "F1"_pos), CellInterface::Value(14.0));
+
+  // Цикл через ячейки снимка
+  bool caught = false;
+  try {
+    fork->SetCell("A1"_pos, "=C1");
+  } catch (const CircularDependencyException&) {
+    caught = true;
+  }
+  ASSERT(caught);
+  ASSERT_EQUAL(fork->GetCell("A1"_pos)->GetText(), "5");
+
+  // Очищенная в копии ячейка закрывает собой значение родителя
+  fork->ClearCell("E1"_pos);
+  ASSERT_EQUAL(sheet.GetCell("E1"_pos)->GetText(), "text");
+  std::ostringstream texts;
+  fork->PrintTexts(texts);
+  ASSERT_EQUAL(texts.str(), "5\t=A1*2\t=B1+1\t7\t\t=D1*2\n");
+
+  auto nested = fork->Fork();
+  nested->SetCell("B1"_pos, "=A1*3");
+  ASSERT_EQUAL(value(*nested, "C1"_pos), CellInterface::Value(16.0));
+  ASSERT_EQUAL(value(*fork, "C1"_pos), CellInterface::Value(11.0));
+  std::ostringstream values;
+  nested->PrintValues(values);
+  ASSERT_EQUAL(values.str(), "5\t15\t16\t7\t\t14\n");
+
+  // Одиночный знак '=' переносится в копию как текст
+  sheet.SetCell("G1"_pos, "=");
+  sheet.SetCell("H1"_pos, "=G1+1");
+  auto plain = sheet.Fork();
+  plain->SetCell("G1"_pos, "2");
+  ASSERT_EQUAL(value(*plain, "H1"_pos), CellInterface::Value(3.0));
+  plain->ClearCell("G1"_pos);
+  ASSERT_EQUAL(value(*plain, "H1"_pos), CellInterface::Value(1.0));
+  auto restored = sheet.Fork();
+  restored->ClearCell("H1"_pos);
+  ASSERT_EQUAL(restored->GetCell("G1"_pos)->GetText(), "=");
+}
+
+void TestParameterSweep() {
+  Sheet sheet;
+  sheet.SetCell("A1"_pos, "1");
+  sheet.SetCell("A2"_pos, "2");
+  sheet.SetCell("B1"_pos, "=A1*A2");
+  sheet.SetCell("C1"_pos, "=10/B1");
+  sheet.SetCell("D1"_pos, "=(C3+1)*2");  // от входов не зависит
+  sheet.SetCell("D2"_pos, "=C1+D1");
+  sheet.SetCell("C3"_pos, "4");
+
+  ParameterSweep sweep(sheet, {"A1"_pos, "A2"_pos},
+                       {"B1"_pos, "D2"_pos, "E5"_pos});
+  ASSERT_EQUAL(sweep.GetProgramSize(), 3u);
+
+  std::vector<std::vector<double>> inputs;
+  for (int i = 0; i < 1000; ++i) {
+    inputs.push_back({double(i), 2.0});
+  }
+  auto results = sweep.Run(inputs, 4);
+  ASSERT_EQUAL(results.size(), inputs.size());
+  ASSERT_EQUAL(results[0][0], CellInterface::Value(0.0));
+  ASSERT_EQUAL(results[0][1],
+               CellInterface::Value(FormulaError(FormulaError::Category::Div0)));
+  ASSERT_EQUAL(results[5][1], CellInterface::Value(11.0));
+  ASSERT_EQUAL(results[999][0], CellInterface::Value(1998.0));
+  ASSERT_EQUAL(results[999][2], CellInterface::Value(0.0));
+
+  // Таблица не изменилась
+  ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetValue(), CellInterface::Value(2.0));
+
+  bool caught = false;
+  try {
+    sweep.Run({{1.0}});
+  } catch (const std::invalid_argument&) {
+    caught = true;
+  }
+  ASSERT(caught);
+
+  // Константы с других листов допустимы, но путь ко входу через другой
+  // лист не должен замораживаться
+  Workbook book;
+  Sheet& model = book.AddSheet("Model");
+  Sheet& other = book.AddSheet("Other");
+  model.SetCell("A1"_pos, "1");
+  other.SetCell("B1"_pos, "5");
+  model.SetCell("C1"_pos, "=Other!B1");
+  model.SetCell("D1"_pos, "=C1+A1");
+  ParameterSweep constant(model, {"A1"_pos}, {"D1"_pos});
+  ASSERT_EQUAL(constant.Run({{2.0}})[0][0], CellInterface::Value(7.0));
+
+  other.SetCell("A1"_pos, "=Model!A1*2");
+  model.SetCell("B1"_pos, "=Other!A1+1");
+  model.SetCell("B2"_pos, "=B1*10");
+  caught = false;
+  try {
+    ParameterSweep looped(model, {"A1"_pos}, {"B2"_pos});
+  } catch (const std::invalid_argument&) {
+    caught = true;
+  }
+  ASSERT(caught);
+}
+
+void TestAsyncRecalculation() {
+  AsyncSheet sheet;
+  sheet.SetCell("A1"_pos, "1");
+  for (int row = 1; row < 200; ++row) {
+    sheet.SetCell({row, 0}, "=A" + std::to_string(row) + "+1");
+  }
+  uint64_t version = sheet.SetCell("B1"_pos, "=A200*2");
+  auto snapshot = sheet.WhenSettled(version).get();
+  ASSERT(snapshot->GetVersion() >= version);
+  ASSERT_EQUAL(snapshot->GetCell("B1"_pos)->GetValue(),
+               CellInterface::Value(400.0));
+
+  // Поток правок: промежуточные версии могут быть пропущены, но итоговая
+  // версия вычисляется полностью
+  for (int i = 2; i <= 100; ++i) {
+    version = sheet.SetCell("A1"_pos, std::to_string(i));
+  }
+  std::promise<double> settled;
+  sheet.OnSettled(version, [&settled](auto snapshot) {
+    settled.set_value(std::get<double>(snapshot->GetCell("B1"_pos)->GetValue()));
+  });
+  ASSERT_EQUAL(settled.get_future().get(), 2 * (100.0 + 199));
+  ASSERT_EQUAL(sheet.GetPublishedSnapshot()->GetVersion(), sheet.GetVersion());
+
+  bool caught = false;
+  try {
+    sheet.SetCell("A1"_pos, "=B1");
+  } catch (const CircularDependencyException&) {
+    caught = true;
+  }
+  ASSERT(caught);
+  ASSERT_EQUAL(sheet.GetVersion(), version);
+
+  // Неудачная правка посреди пересчёта будит фоновый поток
+  AsyncSheet wide;
+  wide.SetCell("A1"_pos, "1");
+  for (int row = 1; row < 10000; ++row) {
+    wide.SetCell({row, 0}, "=A1+" + std::to_string(row));
+  }
+  for (int round = 0; round < 10; ++round) {
+    wide.SetCell("A1"_pos, std::to_string(round));
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    try {
+      wide.SetCell("B1"_pos, "=B1");
+    } catch (const CircularDependencyException&) {
+    }
+    auto settled = wide.WhenSettled(wide.GetVersion());
+    ASSERT(settled.wait_for(std::chrono::seconds(10)) ==
+           std::future_status::ready);
+  }
+}
+
+void TestBoundedEvaluation() {
+  Sheet sheet;
+  sheet.SetCell("A1"_pos, "1");
+  for (int row = 1; row < 100; ++row) {
+    sheet.SetCell({row, 0}, "=A" + std::to_string(row) + "+1");
+  }
+  ASSERT_EQUAL(sheet.GetCell("A100"_pos)->GetValue(),
+               CellInterface::Value(100.0));
+
+  sheet.SetCell("A1"_pos, "2");
+  EvaluationLimit expired;
+  expired.deadline = EvaluationLimit::Clock::now();
+  auto bounded = sheet.GetValueWithin("A100"_pos, expired);
+  ASSERT(bounded.stale);
+  ASSERT_EQUAL(*bounded.value, CellInterface::Value(100.0));
+
+  std::atomic<bool> cancelled = true;
+  EvaluationLimit cancellable;
+  cancellable.cancelled = &cancelled;
+  std::vector<Position> settled;
+  ASSERT(!sheet.EvaluateWithin({"A100"_pos}, cancellable, &settled));
+  ASSERT(settled.empty());
+
+  cancelled = false;
+  ASSERT(sheet.EvaluateWithin({"A100"_pos}, cancellable, &settled));
+  ASSERT_EQUAL(settled.size(), 99u);
+  ASSERT_EQUAL(settled.front(), "A2"_pos);
+  bounded = sheet.GetValueWithin("A100"_pos, expired);
+  ASSERT(!bounded.stale);
+  ASSERT_EQUAL(*bounded.value, CellInterface::Value(101.0));
+
+  sheet.SetCell("B1"_pos, "=A1*10");
+  bounded = sheet.GetValueWithin("B1"_pos, expired);
+  ASSERT(bounded.stale);
+  ASSERT(!bounded.value);
+  ASSERT(!sheet.GetValueWithin("C1"_pos, expired).value);
+
+  sheet.SetCell("A1"_pos, "3");
+  std::ostringstream out;
+  ASSERT(!sheet.PrintValuesWithin(out, expired));
+  ASSERT_EQUAL(out.str().substr(0, 3), "3\t\n");
+  auto unlimited = EvaluationLimit::Within(std::chrono::hours(1));
+  ASSERT(sheet.PrintValuesWithin(out, unlimited));
+  ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetValue(), CellInterface::Value(30.0));
+}
+
+void TestHotRegionsFirst() {
+  Sheet sheet;
+  sheet.SetCell("A1"_pos, "1");
+  sheet.SetCell("B1"_pos, "=A1+1");
+  sheet.SetCell("B50"_pos, "=A1*100");
+  sheet.Snapshot();
+
+  // Неполный снимок содержит только уже вычисленные значения
+  sheet.SetCell("A1"_pos, "2");
+  sheet.GetCell("B1"_pos)->GetValue();
+  auto partial = sheet.SnapshotSettled();
+  ASSERT(!partial->IsComplete());
+  ASSERT_EQUAL(partial->GetCell("B1"_pos)->GetValue(),
+               CellInterface::Value(3.0));
+  ASSERT_EQUAL(partial->GetCell("B50"_pos)->GetValue(),
+               CellInterface::Value(100.0));
+  auto full = sheet.Snapshot();
+  ASSERT(full->IsComplete());
+  ASSERT_EQUAL(full->GetCell("B50"_pos)->GetValue(),
+               CellInterface::Value(200.0));
+
+  AsyncSheet async;
+  async.SetHotRegions({{"A1"_pos, {10, 3}}, {"Z100"_pos}});
+  async.SetCell("A1"_pos, "1");
+  for (int row = 1; row < 100; ++row) {
+    async.SetCell({row, 0}, "=A" + std::to_string(row) + "+1");
+  }
+  async.SetCell("B1"_pos, "=A100");
+  uint64_t version = async.SetCell("Z100"_pos, "=B1*2");
+  auto snapshot = async.WhenSettled(version).get();
+  ASSERT(snapshot->IsComplete());
+  ASSERT_EQUAL(snapshot->GetCell("Z100"_pos)->GetValue(),
+               CellInterface::Value(200.0));
+}
+
+void TestWorkbook() {
+  Workbook book;
+  Sheet& inputs = book.AddSheet("Inputs");
+  Sheet& model = book.AddSheet("Model");
+  inputs.SetCell("A1"_pos, "5");
+  model.SetCell("A1"_pos, "=Inputs!A1*2+B1");
+  ASSERT_EQUAL(model.GetCell("A1"_pos)->GetText(), "=Inputs!A1*2+B1");
+  ASSERT_EQUAL(model.GetCell("A1"_pos)->GetValue(), CellInterface::Value(10.0));
+
+  // Правка одного листа сбрасывает кэш зависимых ячеек другого
+  inputs.SetCell("A1"_pos, "7");
+  ASSERT_EQUAL(model.GetCell("A1"_pos)->GetValue(), CellInterface::Value(14.0));
+  inputs.ClearCell("A1"_pos);
+  ASSERT_EQUAL(model.GetCell("A1"_pos)->GetValue(), CellInterface::Value(0.0));
+
+  auto expect_throw = [](auto action, auto check) {
+    bool caught = false;
+    try {
+      action();
+    } catch (const decltype(check)&) {
+      caught = true;
+    }
+    ASSERT(caught);
+  };
+  expect_throw([&] { model.SetCell("B2"_pos, "=Missing!A1"); },
+               FormulaException(""));
+  expect_throw([&] { inputs.SetCell("A1"_pos, "=Model!A1"); },
+               CircularDependencyException(""));
+  expect_throw([&] { model.SetCell("A2"_pos, "=Model!A2"); },
+               CircularDependencyException(""));
+  expect_throw([&] { book.AddSheet("Model"); }, std::invalid_argument(""));
+  expect_throw([&] { book.AddSheet("2nd sheet"); }, std::invalid_argument(""));
+  // Буквы вне ASCII не допускаются при любой локали
+  ASSERT(SheetPosition::IsValidSheetName("Sheet_2"));
+  ASSERT(!SheetPosition::IsValidSheetName("Sheet\xE9"));
+  ASSERT(!SheetPosition::IsValidSheetName("\xD0\x9B\xD0\xB8\xD1\x81\xD1\x82"));
+  ASSERT(!SheetPosition::IsValidSheetName("Sheet-2"));
+
+  // Отложенный разбор находит ссылки на другие листы без AST
+  ASSERT_EQUAL(ScanSheetReferences("Inputs!B2+A1*x_1!C3+Inputs!B2").size(), 2u);
+  ASSERT_EQUAL(ScanFormulaReferences("Inputs!B2+A1"),
+               std::vector<Position>{"A1"_pos});
+  model.SetDeferredParsing(true);
+  model.SetCell("C1"_pos, "=Inputs!C1+1");
+  inputs.SetCell("C1"_pos, "41");
+  ASSERT_EQUAL(model.GetCell("C1"_pos)->GetValue(), CellInterface::Value(42.0));
+
+  // Независимые листы вычисляются параллельно, итоговый лист - после них
+  Sheet& summary = book.AddSheet("Summary");
+  std::string total = "=0";
+  for (int i = 0; i < 8; ++i) {
+    std::string name = "Part" + std::to_string(i);
+    Sheet& part = book.AddSheet(name);
+    part.SetCell("A1"_pos, std::to_string(i));
+    for (int row = 1; row < 500; ++row) {
+      part.SetCell({row, 0}, "=A" + std::to_string(row) + "+1");
+    }
+    total += "+" + name + "!A500";
+  }
+  summary.SetCell("A1"_pos, total);
+  book.Recalculate(4);
+  ASSERT(static_cast<const Cell*>(summary.GetCell("A1"_pos))->HasCachedValue());
+  ASSERT_EQUAL(summary.GetCell("A1"_pos)->GetValue(),
+               CellInterface::Value(8 * 499.0 + 28));
+  ASSERT_EQUAL(book.GetSheetNames().size(), 11u);
+
+  // Чтение кэша профилируемого листа пишет в его профиль, поэтому два
+  // читающих его листа одного уровня вычисляются по очереди
+  Sheet& mirror = book.AddSheet("Mirror");
+  mirror.SetCell("A1"_pos, total);
+  Sheet& part = *book.GetSheet("Part0");
+  part.SetProfiling(true);
+  part.SetCell("A1"_pos, "10");
+  book.Recalculate(4);
+  ASSERT_EQUAL(mirror.GetCell("A1"_pos)->GetValue(),
+               CellInterface::Value(8 * 499.0 + 38));
+  ASSERT_EQUAL(part.GetProfile().GetCells().at("A500"_pos).cache_hits, 2u);
+}
+
+void TestCalcServerProtocol() {
+  CalcServer server;
+  auto writer = server.OpenSession();
+  auto reader = server.OpenSession();
+
+  // Команды приходят порциями, последняя строка может быть неполной
+  std::string responses = writer->Feed("SET A1 2\nSET B1 =A1*3\nSET C1 =B");
+  ASSERT_EQUAL(responses, "OK 1\nOK 2\n");
+  ASSERT_EQUAL(server.GetRecalculationCount(), 1u);
+  responses = writer->Feed("1+1\nSET D1 =D1\nGET C1\nCLEAR A1\nGET C1\n");
+  ASSERT_EQUAL(responses,
+               "OK 3\nERR Cycle found!\nVALUE 7\nOK 4\nVALUE 1\n");
+  ASSERT_EQUAL(server.GetRecalculationCount(), 3u);
+
+  ASSERT_EQUAL(reader->Feed("GET B1\nGET Z9\nGET 1A\nPRINT TEXTS\nPING\n"),
+               "VALUE 0\nVALUE \nERR Invalid position: 1A\n"
+               "DATA 14\n\t=A1*3\t=B1+1\t\nERR Unknown command\n");
+
+#ifndef _WIN32
+  auto path = (std::filesystem::temp_directory_path() /
+               ("calc_server_test_" +
+                std::to_string(std::chrono::steady_clock::now()
+                                   .time_since_epoch()
+                                   .count()) +
+                ".sock"))
+                  .string();
+  std::atomic<bool> stop = false;
+  std::thread serving([&] { server.ServeUnixSocket(path, stop); });
+  std::unique_ptr<CalcClient> client;
+  for (int attempt = 0; !client; ++attempt) {
+    try {
+      client = std::make_unique<CalcClient>(path);
+    } catch (const std::runtime_error&) {
+      ASSERT(attempt < 100);
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  }
+  std::vector<std::string> commands;
+  for (int i = 1; i <= 100; ++i) {
+    commands.push_back("SET A" + std::to_string(i) + " " + std::to_string(i));
+  }
+  commands.push_back("SET B1 =A100*2");
+  commands.push_back("GET B1");
+  commands.push_back("PRINT VALUES");
+  auto replies = client->Call(commands);
+  CalcClient second(path);
+  auto second_replies = second.Call({"GET A50"});
+  client.reset();
+  stop = true;
+  serving.join();
+
+  ASSERT_EQUAL(replies.size(), commands.size());
+  ASSERT_EQUAL(replies[100], "OK 105");
+  ASSERT_EQUAL(replies[101], "VALUE 200");
+  ASSERT_EQUAL(replies[102].substr(0, 22), "DATA 598\n1\t200\t201\t\n2\t");
+  ASSERT_EQUAL(second_replies, std::vector<std::string>{"VALUE 50"});
+#endif
+}
+
+void TestWorkloadRecording() {
+  const std::string path =
+      (std::filesystem::temp_directory_path() / "etable_test_trace.bin").string();
+  {
+    WorkloadRecorder recorder(path);
+    Sheet sheet;
+    sheet.AttachRecorder(&recorder);
+    sheet.SetCell("A1"_pos, "2");
+    sheet.SetCell("B1"_pos, "=A1*3");
+    sheet.SetCell("C1"_pos, "=B1+A1");
+    // Чтения A1 и B1 при вычислении C1 в трассу не попадают
+    ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetValue(), CellInterface::Value(8.0));
+    try {
+      sheet.SetCell("A1"_pos, "=C1");
+    } catch (const CircularDependencyException&) {
+    }
+    std::ostringstream out;
+    sheet.PrintValues(out);
+    sheet.ClearCell("B1"_pos);
+    sheet.PrintTexts(out);
+    sheet.Snapshot();
+    sheet.AttachRecorder(nullptr);
+    sheet.GetCell("C1"_pos)->GetValue();
+  }
+
+  auto records = WorkloadRecorder::Load(path);
+  std::vector<TraceOperation> operations;
+  for (const TraceRecord& record : records) {
+    operations.push_back(record.operation);
+  }
+  ASSERT_EQUAL(operations.size(), 7u);
+  ASSERT(operations == (std::vector<TraceOperation>{
+                           TraceOperation::SET_CELL, TraceOperation::SET_CELL,
+                           TraceOperation::SET_CELL, TraceOperation::GET_VALUE,
+                           TraceOperation::PRINT_VALUES,
+                           TraceOperation::CLEAR_CELL,
+                           TraceOperation::PRINT_TEXTS}));
+  ASSERT_EQUAL(records[1].pos, "B1"_pos);
+  ASSERT_EQUAL(records[1].text, "=A1*3");
+  ASSERT_EQUAL(records[3].pos, "C1"_pos);
+  ASSERT(records[3].time >= records[2].time);
+
+  Sheet replayed;
+  auto timings = ReplayTrace(records, replayed);
+  ASSERT_EQUAL(timings[TraceOperation::SET_CELL].count, 3u);
+  ASSERT_EQUAL(timings[TraceOperation::SET_CELL].errors, 0u);
+  ASSERT_EQUAL(timings[TraceOperation::GET_VALUE].count, 1u);
+  const ReplayTiming& sets = timings[TraceOperation::SET_CELL];
+  size_t bucketed = 0;
+  for (size_t bucket : sets.buckets) {
+    bucketed += bucket;
+  }
+  ASSERT_EQUAL(bucketed, 3u);
+  ASSERT(sets.Percentile(0.5) <= sets.Percentile(1.0));
+  ASSERT(sets.Percentile(1.0) <= sets.max);
+  ASSERT_EQUAL(replayed.GetCell("C1"_pos)->GetValue(), CellInterface::Value(2.0));
+
+  // Недописанная последняя запись отбрасывается
+  std::filesystem::resize_file(path, std::filesystem::file_size(path) - 1);
+  ASSERT_EQUAL(WorkloadRecorder::Load(path).size(), 6u);
+
+  // Вставка и удаление строк и столбцов записываются и воспроизводятся
+  std::string expected;
+  {
+    WorkloadRecorder recorder(path);
+    Sheet sheet;
+    sheet.AttachRecorder(&recorder);
+    sheet.SetCell("A1"_pos, "1");
+    sheet.SetCell("B2"_pos, "=A1+1");
+    sheet.InsertRows(0, 2);
+    sheet.InsertColumns(1);
+    sheet.DeleteRows(0);
+    sheet.DeleteColumns(0, 1);
+    std::ostringstream out;
+    sheet.PrintTexts(out);
+    expected = out.str();
+  }
+  records = WorkloadRecorder::Load(path);
+  ASSERT_EQUAL(records.size(), 7u);
+  ASSERT(records[2].operation == TraceOperation::INSERT_ROWS);
+  ASSERT_EQUAL(records[2].pos, (Position{0, 2}));
+  ASSERT(records[3].operation == TraceOperation::INSERT_COLUMNS);
+  ASSERT(records[4].operation == TraceOperation::DELETE_ROWS);
+  ASSERT(records[5].operation == TraceOperation::DELETE_COLUMNS);
+  Sheet shifted;
+  timings = ReplayTrace(records, shifted);
+  ASSERT_EQUAL(timings[TraceOperation::DELETE_COLUMNS].count, 1u);
+  ASSERT_EQUAL(timings[TraceOperation::DELETE_COLUMNS].errors, 0u);
+  std::ostringstream texts;
+  shifted.PrintTexts(texts);
+  ASSERT_EQUAL(texts.str(), expected);
+  ASSERT_EQUAL(shifted.GetCell("B3"_pos)->GetText(), "=#REF!+1");
+  std::filesystem::remove(path);
+}
+
+void TestRecalculationProfile() {
+  Sheet sheet;
+  sheet.SetCell("A1"_pos, "1");
+  sheet.SetCell("A2"_pos, "=A1+1");
+  ASSERT(sheet.GetProfile().GetCells().empty());
+
+  sheet.SetProfiling(true);
+  sheet.SetCell("A3"_pos, "=A2*2");
+  sheet.SetCell("B1"_pos, "=A1");
+  ASSERT_EQUAL(sheet.GetCell("A3"_pos)->GetValue(), CellInterface::Value(4.0));
+  ASSERT_EQUAL(sheet.GetCell("A3"_pos)->GetValue(), CellInterface::Value(4.0));
+
+  auto profile = sheet.GetProfile();
+  const auto& a2 = profile.GetCells().at("A2"_pos);
+  const auto& a3 = profile.GetCells().at("A3"_pos);
+  ASSERT_EQUAL(a2.evaluations, 1u);
+  // Значение A2 ещё раз прочитано формулой A3
+  ASSERT_EQUAL(a2.cache_hits, 1u);
+  ASSERT_EQUAL(a2.parses, 0u);
+  ASSERT_EQUAL(a3.evaluations, 1u);
+  ASSERT_EQUAL(a3.cache_hits, 1u);
+  ASSERT_EQUAL(a3.parses, 1u);
+  ASSERT_EQUAL(a3.GetCacheHitRatio(), 0.5);
+
+  // Сбрасываются только вычисленные зависимые: A2 и A3, но не B1
+  sheet.SetCell("A1"_pos, "5");
+  profile = sheet.GetProfile();
+  ASSERT_EQUAL(profile.GetCells().at("A1"_pos).invalidations, 1u);
+  ASSERT_EQUAL(profile.GetCells().at("A1"_pos).invalidation_fanout, 2u);
+  ASSERT_EQUAL(sheet.GetCell("A3"_pos)->GetValue(), CellInterface::Value(12.0));
+  profile = sheet.GetProfile();
+  ASSERT_EQUAL(profile.GetCells().at("A3"_pos).evaluations, 2u);
+
+  auto top = profile.GetTopByEvaluationTime(1);
+  ASSERT_EQUAL(top.size(), 1u);
+  ASSERT(top.front().first == "A2"_pos || top.front().first == "A3"_pos);
+  auto fanout = profile.GetTopByInvalidationFanout(10);
+  ASSERT_EQUAL(fanout.size(), 1u);
+  ASSERT_EQUAL(fanout.front().first, "A1"_pos);
+
+  // Одинаковые формулы разных ячеек складываются
+  sheet.SetCell("B3"_pos, "=A2*2");
+  ASSERT_EQUAL(sheet.GetCell("B3"_pos)->GetValue(), CellInterface::Value(12.0));
+  profile = sheet.GetProfile();
+  auto formulas = profile.GetTopFormulasByEvaluationTime(sheet, 10);
+  ASSERT_EQUAL(formulas.size(), 2u);
+  auto doubled = std::find_if(formulas.begin(), formulas.end(),
+                              [](const auto& formula) {
+                                return formula.text == "=A2*2";
+                              });
+  ASSERT(doubled != formulas.end());
+  ASSERT_EQUAL(doubled->cells, 2u);
+  ASSERT_EQUAL(doubled->evaluations, 3u);
+  ASSERT_EQUAL(doubled->cache_hits, 1u);
+
+  std::ostringstream report;
+  profile.PrintReport(report, sheet, 5);
+  ASSERT(report.str().find("=A2*2") != std::string::npos);
+  ASSERT(report.str().find("Hot formulas") != std::string::npos);
+  ASSERT(report.str().find("A1") != std::string::npos);
+
+  // Замеры переезжают вместе с ячейками, замеры удалённых ячеек пропадают
+  size_t a2_evaluations = profile.GetCells().at("A2"_pos).evaluations;
+  sheet.InsertRows(1);
+  profile = sheet.GetProfile();
+  ASSERT(profile.GetCells().count("A2"_pos) == 0);
+  ASSERT_EQUAL(profile.GetCells().at("A3"_pos).evaluations, a2_evaluations);
+  ASSERT_EQUAL(profile.GetCells().count("B4"_pos), 1u);
+  sheet.DeleteRows(0);
+  profile = sheet.GetProfile();
+  ASSERT_EQUAL(profile.GetCells().at("A2"_pos).evaluations, a2_evaluations);
+  ASSERT_EQUAL(profile.GetCells().at("B3"_pos).evaluations, 1u);
+  ASSERT(profile.GetCells().count("A4"_pos) == 0);
+  ASSERT(profile.GetCells().count("B4"_pos) == 0);
+
+  sheet.SetProfiling(false);
+  ASSERT(sheet.GetProfile().GetCells().empty());
+}
+
+void TestChromeTraceExport() {
+  Tracer::Clear();
+  Sheet sheet;
+  sheet.SetCell("A1"_pos, "1");
+  std::ostringstream trace;
+  Tracer::WriteChromeTrace(trace);
+  ASSERT(trace.str().find("\"ph\"") == std::string::npos);
+
+  Tracer::Enable(true);
+  sheet.SetCell("A2"_pos, "=A1+1");
+  std::thread([] {
+    Sheet other;
+    other.SetCell("B1"_pos, "=1/0");
+    std::ostringstream out;
+    other.PrintValues(out);
+  }).join();
+  ASSERT_EQUAL(sheet.GetCell("A2"_pos)->GetValue(), CellInterface::Value(2.0));
+  Tracer::Enable(false);
+  sheet.SetCell("A3"_pos, "=A2");
+
+  trace.str({});
+  Tracer::WriteChromeTrace(trace);
+  const std::string json = trace.str();
+  for (const char* span : {"Sheet::SetCell", "Cell::Set", "Cell::CheckForCycles",
+                           "Cell::ParseFormula", "Cell::FillReferencedCells",
+                           "Cell::DeleteCache", "Cell::CalculateFormula",
+                           "FormulaAST::Execute", "Sheet::Print"}) {
+    ASSERT(json.find(span) != std::string::npos);
+  }
+  ASSERT(json.find("\"ph\": \"X\"") != std::string::npos);
+  ASSERT(json.find("\"tid\": ") != std::string::npos);
+  // События второго потока записаны в его собственный буфер
+  std::set<std::string> threads;
+  for (size_t pos = json.find("\"tid\": "); pos != std::string::npos;
+       pos = json.find("\"tid\": ", pos + 1)) {
+    threads.insert(json.substr(pos, json.find('}', pos) - pos));
+  }
+  ASSERT_EQUAL(threads.size(), 2u);
+  size_t set_cells = 0;
+  for (size_t pos = json.find("Sheet::SetCell"); pos != std::string::npos;
+       pos = json.find("Sheet::SetCell", pos + 1)) {
+    ++set_cells;
+  }
+  ASSERT_EQUAL(set_cells, 2u);
+
+  // Переполненный буфер хранит только последние события
+  Tracer::Clear();
+  Tracer::Enable(true);
+  for (size_t i = 0; i < Tracer::BUFFER_EVENTS + 10; ++i) {
+    TraceSpan span("Test::Span");
+  }
+  Tracer::Enable(false);
+  trace.str({});
+  Tracer::WriteChromeTrace(trace);
+  const std::string overflowed = trace.str();
+  size_t events = 0;
+  for (size_t pos = overflowed.find("\"ph\""); pos != std::string::npos;
+       pos = overflowed.find("\"ph\"", pos + 1)) {
+    ++events;
+  }
+  ASSERT_EQUAL(events, Tracer::BUFFER_EVENTS);
+  Tracer::Clear();
+}
+
+void TestMemoryStats() {
+  Sheet sheet;
+  ASSERT_EQUAL(sheet.GetMemoryStats().GetTotalBytes(), 0u);
+
+  sheet.SetCell("A1"_pos, "some text long enough to leave the small buffer");
+  sheet.SetCell("C3"_pos, "=A1+B1");
+  auto stats = sheet.GetMemoryStats();
+  // Ссылка на пустую B1 хранится в индексе, а не в ячейке
+  ASSERT_EQUAL(stats.cells.count, 2u);
+  ASSERT_EQUAL(stats.cell_slots.count, 4u);
+  ASSERT_EQUAL(stats.texts.count, 1u);
+  ASSERT(stats.texts.bytes >= 47u);
+  ASSERT_EQUAL(stats.formulas.count, 1u);
+  ASSERT(stats.formulas.bytes > 2 * sizeof(Position));
+  ASSERT_EQUAL(stats.dependency_edges.count, 3u);
+  ASSERT_EQUAL(stats.cached_values.count, 0u);
+
+  sheet.GetCell("C3"_pos)->GetValue();
+  ASSERT_EQUAL(sheet.GetMemoryStats().cached_values.count, 1u);
+  // Значение хранится отдельно от формулы и учитывается один раз
+  ASSERT_EQUAL(sheet.GetMemoryStats().GetTotalBytes(),
+               stats.GetTotalBytes() + sizeof(CellInterface::Value));
+  // Устаревшее значение хранится до следующего вычисления
+  sheet.SetCell("A1"_pos, "1");
+  stats = sheet.GetMemoryStats();
+  ASSERT_EQUAL(stats.cached_values.count, 1u);
+  ASSERT_EQUAL(stats.texts.count, 1u);
+
+  sheet.SetCell("C3"_pos, "=A1");
+  ASSERT_EQUAL(sheet.GetMemoryStats().dependency_edges.count, 2u);
+  ASSERT_EQUAL(sheet.GetMemoryStats().cached_values.count, 0u);
+  sheet.ClearCell("C3"_pos);
+  sheet.ClearCell("A1"_pos);
+  sheet.ClearCell("B1"_pos);
+  stats = sheet.GetMemoryStats();
+  ASSERT_EQUAL(stats.cells.count, 0u);
+  ASSERT_EQUAL(stats.cells.bytes, 0u);
+  ASSERT_EQUAL(stats.texts.bytes, 0u);
+  ASSERT_EQUAL(stats.formulas.bytes, 0u);
+  ASSERT_EQUAL(stats.dependency_edges.bytes, 0u);
+  ASSERT_EQUAL(stats.GetTotalBytes(), stats.cell_slots.bytes);
+
+  // Отложенная формула занимает место под AST только после разбора
+  Sheet deferred;
+  deferred.SetDeferredParsing(true);
+  deferred.SetCell("A1"_pos, "=1+2*3");
+  size_t unparsed = deferred.GetMemoryStats().formulas.bytes;
+  ASSERT_EQUAL(deferred.GetCell("A1"_pos)->GetValue(),
+               CellInterface::Value(7.0));
+  ASSERT(deferred.GetMemoryStats().formulas.bytes > unparsed);
+
+  // Короткий текст без рёбер не занимает памяти вне записи ячейки
+  Sheet numbers;
+  for (int row = 0; row < 1000; ++row) {
+    numbers.SetCell({row, 0}, std::to_string(row * 7));
+  }
+  stats = numbers.GetMemoryStats();
+  ASSERT_EQUAL(stats.cells.bytes, 1000 * sizeof(Cell));
+  ASSERT_EQUAL(stats.texts.bytes, 0u);
+  ASSERT_EQUAL(stats.dependency_edges.bytes, 0u);
+  ASSERT_EQUAL(numbers.GetCell("A1000"_pos)->GetText(), "6993");
+}
+
+void TestValueCacheBudget() {
+  Sheet sheet;
+  const size_t value_bytes = sizeof(CellInterface::Value);
+  // Цепочка A1 <- A2 <- ... <- A20: каждая формула прибавляет единицу
+  sheet.SetCell("A1"_pos, "1");
+  for (int row = 1; row < 20; ++row) {
+    sheet.SetCell({row, 0}, "=A" + std::to_string(row) + "+1");
+  }
+  sheet.SetValueCacheBudget(4 * value_bytes);
+  sheet.SetValuePinned("A10"_pos, true);
+
+  ASSERT_EQUAL(sheet.GetCell("A20"_pos)->GetValue(),
+               CellInterface::Value(20.0));
+  ValueCache* cache = sheet.GetValueCache();
+  ASSERT(cache != nullptr);
+  ASSERT(cache->GetEvictionCount() > 0u);
+  ASSERT(cache->GetUsedBytes() <= 4 * value_bytes);
+  ASSERT(sheet.GetMemoryStats().cached_values.bytes <= 4 * value_bytes);
+  const Cell* pinned = static_cast<const Cell*>(sheet.GetCell("A10"_pos));
+  ASSERT(pinned->HasCachedValue());
+  ASSERT(!static_cast<const Cell*>(sheet.GetCell("A2"_pos))->HasCachedValue());
+
+  // Вытесненные значения вычисляются заново
+  for (int row = 1; row < 20; ++row) {
+    ASSERT_EQUAL(sheet.GetCell({row, 0})->GetValue(),
+                 CellInterface::Value(row + 1.0));
+  }
+  ASSERT(sheet.GetMemoryStats().cached_values.bytes <= 4 * value_bytes);
+
+  // Сброс проходит через вытесненные ячейки до закэшированных зависимых
+  ASSERT_EQUAL(sheet.GetCell("A20"_pos)->GetValue(),
+               CellInterface::Value(20.0));
+  sheet.SetCell("A1"_pos, "101");
+  ASSERT_EQUAL(sheet.GetCell("A20"_pos)->GetValue(),
+               CellInterface::Value(120.0));
+  ASSERT_EQUAL(sheet.GetCell("A10"_pos)->GetValue(),
+               CellInterface::Value(110.0));
+
+  // Без бюджета значения больше не вытесняются
+  sheet.SetValueCacheBudget(std::nullopt);
+  ASSERT(sheet.GetValueCache() == nullptr);
+  for (int row = 1; row < 20; ++row) {
+    sheet.GetCell({row, 0})->GetValue();
+  }
+  ASSERT_EQUAL(sheet.GetMemoryStats().cached_values.count, 19u);
+
+  // Новый бюджет сразу вытесняет лишние значения и освобождает их память
+  size_t total_bytes = sheet.GetMemoryStats().GetTotalBytes();
+  sheet.SetValueCacheBudget(2 * value_bytes);
+  ASSERT_EQUAL(sheet.GetMemoryStats().cached_values.count, 2u);
+  ASSERT_EQUAL(sheet.GetMemoryStats().GetTotalBytes(),
+               total_bytes - 17 * value_bytes);
+  ASSERT_EQUAL(sheet.GetCell("A20"_pos)->GetValue(),
+               CellInterface::Value(120.0));
+
+  // Аргументы формулы не вытесняются, пока она не вычислена
+  std::string sum = "=A1";
+  for (int row = 2; row <= 20; ++row) {
+    sum += "+A" + std::to_string(row);
+  }
+  sheet.SetCell("C1"_pos, sum);
+  sheet.SetCell("A1"_pos, "1");
+  sheet.SetProfiling(true);
+  ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetValue(),
+               CellInterface::Value(20.0 * 21 / 2));
+  ASSERT_EQUAL(sheet.GetProfile().GetCells().at("C1"_pos).evaluations, 1u);
+  ASSERT(sheet.GetMemoryStats().cached_values.count <= 2u);
+
+  // Ошибка при вычислении аргумента снимает удержания остальных
+  Sheet deferred;
+  deferred.SetDeferredParsing(true);
+  deferred.SetValueCacheBudget(8 * value_bytes);
+  deferred.SetCell("A1"_pos, "=1");
+  deferred.SetCell("A2"_pos, "=2");
+  deferred.SetCell("A3"_pos, "=1+");
+  deferred.SetCell("B1"_pos, "=A1+A2+A3");
+  deferred.GetCell("A1"_pos)->GetValue();
+  deferred.GetCell("A2"_pos)->GetValue();
+  try {
+    deferred.GetCell("B1"_pos)->GetValue();
+  } catch (const FormulaException&) {
+  }
+  deferred.SetValueCacheBudget(0);
+  ASSERT_EQUAL(deferred.GetMemoryStats().cached_values.count, 0u);
+}
+
+void TestEmptyReferences() {
+  Sheet sheet;
+  sheet.SetCell("A1"_pos, "=XFD16384+B1");
+  // Пустые ячейки, на которые ссылается формула, не создаются
+  ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{1, 1}));
+  ASSERT_EQUAL(sheet.GetMemoryStats().cell_slots.count, 1u);
+  ASSERT_EQUAL(sheet.GetCell("XFD16384"_pos)->GetText(), "");
+  ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetValue(), CellInterface::Value(0.0));
+
+  sheet.SetCell("B1"_pos, "2");
+  ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetValue(), CellInterface::Value(2.0));
+  sheet.ClearCell("B1"_pos);
+  ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetValue(), CellInterface::Value(0.0));
+  ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{1, 1}));
+  ASSERT(sheet.GetCell("B1"_pos) != nullptr);
+
+  // Цикл через ячейку, которая раньше была пустой
+  bool caught = false;
+  try {
+    sheet.SetCell("B1"_pos, "=A1");
+  } catch (const CircularDependencyException&) {
+    caught = true;
+  }
+  ASSERT(caught);
+
+  sheet.SetCell("A1"_pos, "1");
+  ASSERT(sheet.GetCell("XFD16384"_pos) == nullptr);
+  ASSERT_EQUAL(sheet.GetMemoryStats().dependency_edges.count, 0u);
+}
+void TestStringPool() {
+  Sheet sheet;
+  const std::string label = "Category: consumer electronics";
+  for (int row = 0; row < 100; ++row) {
+    sheet.SetCell({row, 0}, label);
+    sheet.SetCell({row, 1}, "USD");
+  }
+  // Длинный текст хранится один раз, короткий - в самих ячейках
+  ASSERT_EQUAL(sheet.GetStringPool().GetSize(), 1u);
+  auto stats = sheet.GetMemoryStats();
+  ASSERT_EQUAL(stats.texts.count, 101u);
+  ASSERT(stats.texts.bytes < 2 * label.size() + 128);
+
+  sheet.SetCell("C1"_pos, "'=escaped text that is long enough");
+  ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetValue(),
+               CellInterface::Value("=escaped text that is long enough"));
+  ASSERT_EQUAL(sheet.GetStringPool().GetSize(), 2u);
+  std::ostringstream values;
+  sheet.PrintValues(values);
+  ASSERT(values.str().find(label + "\tUSD\t=escaped") == 0);
+
+  for (int row = 0; row < 99; ++row) {
+    sheet.ClearCell({row, 0});
+  }
+  ASSERT_EQUAL(sheet.GetStringPool().GetSize(), 2u);
+  sheet.SetCell({99, 0}, "=1");
+  sheet.ClearCell("C1"_pos);
+  ASSERT_EQUAL(sheet.GetStringPool().GetSize(), 0u);
+  ASSERT_EQUAL(sheet.GetMemoryStats().texts.bytes, 0u);
+}
+void TestPositionKey() {
+  const std::vector<Position> positions = {
+      {0, 0}, {0, 1}, {1, 0}, {5, 27}, {Position::MAX_ROWS - 1, 0},
+      {0, Position::MAX_COLS - 1},
+      {Position::MAX_ROWS - 1, Position::MAX_COLS - 1}};
+  for (Position pos : positions) {
+    ASSERT_EQUAL(PositionKey(pos).ToPosition(), pos);
+    ASSERT_EQUAL(Position::FromString(pos.ToString()), pos);
+    for (Position other : positions) {
+      ASSERT_EQUAL(PositionKey(pos) < PositionKey(other), pos < other);
+    }
+  }
+  // Z-порядок обходит квадрат 2x2 раньше, чем уходит дальше по строке
+  ASSERT_EQUAL(PositionKey({0, 0}).GetMortonCode(), 0u);
+  ASSERT_EQUAL(PositionKey({0, 1}).GetMortonCode(), 1u);
+  ASSERT_EQUAL(PositionKey({1, 0}).GetMortonCode(), 2u);
+  ASSERT_EQUAL(PositionKey({1, 1}).GetMortonCode(), 3u);
+  ASSERT_EQUAL(PositionKey({0, 2}).GetMortonCode(), 4u);
+
+  ASSERT_EQUAL(Position::FromString("A01"), (Position{0, 0}));
+  ASSERT_EQUAL(Position::FromString("XFD16384").ToString(), "XFD16384");
+  ASSERT_EQUAL(Position::FromString("A99999999999"), Position::NONE);
+  ASSERT_EQUAL(Position::FromString("a1"), Position::NONE);
+  ASSERT_EQUAL(Position::FromString("A1 "), Position::NONE);
+}
+void TestSharedSubexpressions() {
+  Sheet sheet;
+  sheet.SetSubexpressionSharing(true);
+  sheet.SetCell("B1"_pos, "2");
+  sheet.SetCell("C1"_pos, "3");
+  sheet.SetCell("D1"_pos, "4");
+  for (int row = 1; row <= 20; ++row) {
+    sheet.SetCell({row, 0}, "=(B1*C1+D1)*" + std::to_string(row));
+  }
+  const SharedSubexpressions* shared = sheet.GetSharedSubexpressions();
+  // B1*C1, B1*C1+D1 и корни формул
+  ASSERT_EQUAL(shared->GetSize(), 22u);
+  ASSERT_EQUAL(sheet.GetCell("A3"_pos)->GetText(), "=(B1*C1+D1)*2");
+  for (int row = 1; row <= 20; ++row) {
+    ASSERT_EQUAL(sheet.GetCell({row, 0})->GetValue(),
+                 CellInterface::Value(10.0 * row));
+  }
+  ASSERT_EQUAL(shared->GetHitCount(), 19u);
+
+  // Правка аргумента сбрасывает значения общих подвыражений
+  sheet.SetCell("B1"_pos, "5");
+  ASSERT_EQUAL(sheet.GetCell("A21"_pos)->GetValue(),
+               CellInterface::Value(380.0));
+  sheet.SetCell("D1"_pos, "text");
+  ASSERT_EQUAL(sheet.GetCell("A2"_pos)->GetValue(),
+               CellInterface::Value(FormulaError::Category::Value));
+  ASSERT_EQUAL(sheet.GetCell("A3"_pos)->GetValue(),
+               CellInterface::Value(FormulaError::Category::Value));
+
+  for (int row = 1; row <= 20; ++row) {
+    sheet.ClearCell({row, 0});
+  }
+  ASSERT_EQUAL(shared->GetSize(), 0u);
+
+  // Ячейка, зависящая от другого листа, сбрасывает общие подвыражения
+  // своего листа
+  Workbook book;
+  Sheet& inputs = book.AddSheet("Inputs");
+  Sheet& model = book.AddSheet("Model");
+  model.SetSubexpressionSharing(true);
+  inputs.SetCell("A1"_pos, "1");
+  model.SetCell("B1"_pos, "=Inputs!A1");
+  model.SetCell("A1"_pos, "=B1*2+1");
+  model.SetCell("A2"_pos, "=B1*2+3");
+  ASSERT_EQUAL(model.GetCell("A1"_pos)->GetValue(), CellInterface::Value(3.0));
+  ASSERT_EQUAL(model.GetCell("A2"_pos)->GetValue(), CellInterface::Value(5.0));
+  inputs.SetCell("A1"_pos, "10");
+  ASSERT_EQUAL(model.GetCell("A1"_pos)->GetValue(), CellInterface::Value(21.0));
+  ASSERT_EQUAL(model.GetCell("A2"_pos)->GetValue(), CellInterface::Value(23.0));
+
+  // Константы, различающиеся дальше шестой значащей цифры, дают разные узлы
+  Sheet precise;
+  precise.SetSubexpressionSharing(true);
+  precise.SetCell("A1"_pos, "1");
+  precise.SetCell("B1"_pos, "=(A1+1234567)*2");
+  precise.SetCell("B2"_pos, "=(A1+1234568)*2");
+  precise.SetCell("C1"_pos, "=A1*1.0000001");
+  precise.SetCell("C2"_pos, "=A1*1.0000002");
+  ASSERT_EQUAL(precise.GetCell("B1"_pos)->GetValue(),
+               CellInterface::Value(2469136.0));
+  ASSERT_EQUAL(precise.GetCell("B2"_pos)->GetValue(),
+               CellInterface::Value(2469138.0));
+  ASSERT_EQUAL(precise.GetCell("C1"_pos)->GetValue(),
+               CellInterface::Value(1.0000001));
+  ASSERT_EQUAL(precise.GetCell("C2"_pos)->GetValue(),
+               CellInterface::Value(1.0000002));
+  ASSERT_EQUAL(precise.GetSharedSubexpressions()->GetHitCount(), 0u);
+}
+
+void TestInsertDeleteRowsColumns() {
+  using Value = CellInterface::Value;
+  Workbook book;
+  Sheet& sheet = book.AddSheet("Data");
+  Sheet& report = book.AddSheet("Report");
+  sheet.SetSubexpressionSharing(true);
+  sheet.SetCell("A1"_pos, "1");
+  sheet.SetCell("A2"_pos, "2");
+  sheet.SetCell("B1"_pos, "=A1+A2");
+  sheet.SetCell("B2"_pos, "=(A1+A2)*2");
+  sheet.SetCell("B3"_pos, "=A3*2");
+  report.SetCell("A1"_pos, "=Data!A2*10");
+  ASSERT_EQUAL(sheet.GetCell("B2"_pos)->GetValue(), Value(6.0));
+
+  // Ссылки на сдвинутые ячейки, в том числе пустые и с других листов,
+  // переписываются, а рёбра графа остаются
+  sheet.InsertRows(1, 2);
+  ASSERT(sheet.GetCell("A2"_pos) == nullptr);
+  ASSERT_EQUAL(sheet.GetCell("A4"_pos)->GetText(), "2");
+  ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetText(), "=A1+A4");
+  ASSERT_EQUAL(sheet.GetCell("B4"_pos)->GetText(), "=(A1+A4)*2");
+  ASSERT_EQUAL(sheet.GetCell("B5"_pos)->GetText(), "=A5*2");
+  ASSERT_EQUAL(report.GetCell("A1"_pos)->GetText(), "=Data!A4*10");
+  ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{5, 2}));
+  sheet.SetCell("A4"_pos, "3");
+  sheet.SetCell("A5"_pos, "4");
+  ASSERT_EQUAL(sheet.GetCell("B4"_pos)->GetValue(), Value(8.0));
+  ASSERT_EQUAL(sheet.GetCell("B5"_pos)->GetValue(), Value(8.0));
+  ASSERT_EQUAL(report.GetCell("A1"_pos)->GetValue(), Value(30.0));
+
+  sheet.InsertColumns(0);
+  ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetText(), "=B1+B4");
+  ASSERT_EQUAL(report.GetCell("A1"_pos)->GetText(), "=Data!B4*10");
+
+  // Ссылки на удалённые ячейки становятся #REF!
+  sheet.DeleteRows(3);
+  ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetText(), "=B1+#REF!");
+  ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetValue(),
+               Value(FormulaError(FormulaError::Category::Ref)));
+  ASSERT_EQUAL(report.GetCell("A1"_pos)->GetText(), "=#REF!*10");
+  ASSERT_EQUAL(report.GetCell("A1"_pos)->GetValue(),
+               Value(FormulaError(FormulaError::Category::Ref)));
+  ASSERT_EQUAL(sheet.GetCell("C4"_pos)->GetText(), "=B4*2");
+  ASSERT_EQUAL(sheet.GetCell("C4"_pos)->GetValue(), Value(8.0));
+  sheet.SetCell("B4"_pos, "5");
+  ASSERT_EQUAL(sheet.GetCell("C4"_pos)->GetValue(), Value(10.0));
+
+  // Текст с #REF! разбирается снова
+  sheet.SetCell("D1"_pos, "=#REF!+1");
+  ASSERT_EQUAL(sheet.GetCell("D1"_pos)->GetText(), "=#REF!+1");
+  ASSERT(sheet.GetCell("D1"_pos)->GetReferencedCells().empty());
+
+  sheet.DeleteColumns(0, 2);
+  ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetText(), "=#REF!+#REF!");
+  ASSERT_EQUAL(sheet.GetCell("A4"_pos)->GetText(), "=#REF!*2");
+  ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{4, 2}));
+  std::ostringstream texts;
+  sheet.PrintTexts(texts);
+  ASSERT_EQUAL(texts.str(), "=#REF!+#REF!\t=#REF!+1\n\t\n\t\n=#REF!*2\t\n");
+
+  bool caught = false;
+  try {
+    sheet.SetCell({Position::MAX_ROWS - 1, 0}, "x");
+    sheet.InsertRows(0);
+  } catch (const InvalidPositionException&) {
+    caught = true;
+  }
+  ASSERT(caught);
+  caught = false;
+  try {
+    sheet.DeleteColumns(0, 0);
+  } catch (const InvalidPositionException&) {
+    caught = true;
+  }
+  ASSERT(caught);
+}
+
+void TestDeadReferencesInJournal() {
+  const std::string path =
+      (std::filesystem::temp_directory_path() / "etable_test_dead_refs.bin").string();
+  std::filesystem::remove(path);
+
+  // При отложенном разборе ссылки ищутся сканером текста, и #REF! не должен
+  // читаться как ссылка на лист REF
+  {
+    ChangeJournal journal(path);
+    Sheet sheet;
+    sheet.SetDeferredParsing(true);
+    sheet.AttachJournal(&journal);
+    sheet.SetCell("A1"_pos, "1");
+    sheet.SetCell("A2"_pos, "2");
+    sheet.SetCell("B1"_pos, "=A1+A2");
+    sheet.DeleteRows(1);
+    ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetText(), "=A1+#REF!");
+    sheet.SetCell("C1"_pos, "=#REF!*2");
+    ASSERT(sheet.GetCell("C1"_pos)->GetReferencedCells().empty());
+  }
+
+  // Удаление строки - одна запись журнала, а не его перезапись
+  Sheet replayed;
+  replayed.SetDeferredParsing(true);
+  ASSERT_EQUAL(ChangeJournal::Replay(path, replayed), 5u);
+  ASSERT_EQUAL(replayed.GetCell("B1"_pos)->GetText(), "=A1+#REF!");
+  ASSERT_EQUAL(replayed.GetCell("B1"_pos)->GetReferencedCells(),
+               std::vector<Position>{"A1"_pos});
+  ASSERT_EQUAL(replayed.GetCell("C1"_pos)->GetValue(),
+               CellInterface::Value(FormulaError(FormulaError::Category::Ref)));
+
+  {
+    ChangeJournal journal(path);
+    journal.Compact(replayed);
+  }
+  Sheet compacted;
+  compacted.SetDeferredParsing(true);
+  ASSERT_EQUAL(ChangeJournal::Replay(path, compacted), 3u);
+  ASSERT_EQUAL(compacted.GetCell("C1"_pos)->GetText(), "=#REF!*2");
+
+  std::filesystem::remove(path);
+}
 }  // namespace
 
 int main() {
@@ -409,6 +1812,31 @@ int main() {
     RUN_TEST(tr, TestFormulaIncorrect);
     RUN_TEST(tr, TestCellCircularReferences);
     RUN_TEST(tr, TestExtra);
+    RUN_TEST(tr, TestScanFormulaReferences);
+    RUN_TEST(tr, TestDeferredFormulaParsing);
+    RUN_TEST(tr, TestChangeJournalReplay);
+    RUN_TEST(tr, TestChangeFeed);
+    RUN_TEST(tr, TestEagerRecalculationEarlyCutoff);
+    RUN_TEST(tr, TestDeepChainEvaluation);
+    RUN_TEST(tr, TestSheetSnapshots);
+    RUN_TEST(tr, TestSheetFork);
+    RUN_TEST(tr, TestParameterSweep);
+    RUN_TEST(tr, TestAsyncRecalculation);
+    RUN_TEST(tr, TestBoundedEvaluation);
+    RUN_TEST(tr, TestHotRegionsFirst);
+    RUN_TEST(tr, TestWorkbook);
+    RUN_TEST(tr, TestCalcServerProtocol);
+    RUN_TEST(tr, TestWorkloadRecording);
+    RUN_TEST(tr, TestRecalculationProfile);
+    RUN_TEST(tr, TestChromeTraceExport);
+    RUN_TEST(tr, TestMemoryStats);
+    RUN_TEST(tr, TestValueCacheBudget);
+    RUN_TEST(tr, TestEmptyReferences);
+    RUN_TEST(tr, TestStringPool);
+    RUN_TEST(tr, TestPositionKey);
+    RUN_TEST(tr, TestSharedSubexpressions);
+    RUN_TEST(tr, TestInsertDeleteRowsColumns);
+    RUN_TEST(tr, TestDeadReferencesInJournal);
  
     return 0;
 }
\ No newline at end of file
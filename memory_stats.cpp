@@ -0,0 +1,46 @@
+#include "memory_stats.h"
+
+MemoryStats::Usage& MemoryStats::Usage::operator+=(const Usage& other) {
+  bytes += other.bytes;
+  count += other.count;
+  return *this;
+}
+
+MemoryStats::Usage& MemoryStats::Usage::operator-=(const Usage& other) {
+  bytes -= other.bytes;
+  count -= other.count;
+  return *this;
+}
+
+size_t MemoryStats::GetTotalBytes() const {
+  return cell_slots.bytes + cells.bytes + texts.bytes + formulas.bytes +
+         dependency_edges.bytes + cached_values.bytes;
+}
+
+MemoryStats MemoryStats::ForEdges(size_t edges) {
+  // Узел std::set: значение, три указателя и цвет
+  const size_t set_node_bytes = sizeof(void*) + 4 * sizeof(void*);
+  MemoryStats usage;
+  usage.dependency_edges = {edges * set_node_bytes, edges};
+  return usage;
+}
+
+MemoryStats& MemoryStats::operator+=(const MemoryStats& other) {
+  cell_slots += other.cell_slots;
+  cells += other.cells;
+  texts += other.texts;
+  formulas += other.formulas;
+  dependency_edges += other.dependency_edges;
+  cached_values += other.cached_values;
+  return *this;
+}
+
+MemoryStats& MemoryStats::operator-=(const MemoryStats& other) {
+  cell_slots -= other.cell_slots;
+  cells -= other.cells;
+  texts -= other.texts;
+  formulas -= other.formulas;
+  dependency_edges -= other.dependency_edges;
+  cached_values -= other.cached_values;
+  return *this;
+}
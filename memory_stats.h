@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+
+// Память таблицы по подсистемам. Размеры - оценки: учитываются объекты и
+// принадлежащие им буферы, но не служебные данные аллокатора.
+struct MemoryStats {
+  struct Usage {
+    size_t bytes = 0;
+    size_t count = 0;
+
+    Usage& operator+=(const Usage& other);
+    Usage& operator-=(const Usage& other);
+  };
+
+  // Ячейки сетки data_, включая пустые (count), и сами строки сетки
+  Usage cell_slots;
+  // Живые объекты Cell вместе с их содержимым без учёта остальных категорий
+  Usage cells;
+  // Тексты текстовых ячеек. Длинные тексты хранятся в пуле таблицы и
+  // учитываются один раз, сколько бы ячеек их ни содержало.
+  Usage texts;
+  // Формулы: AST, списки ячеек-аргументов и тексты отложенных формул
+  Usage formulas;
+  // Рёбра графа зависимостей вместе с блоками множеств рёбер ячеек; count -
+  // число записей в этих множествах и в индексе ссылок на пустые ячейки
+  Usage dependency_edges;
+  // Закэшированные значения формул, включая устаревшие
+  Usage cached_values;
+
+  size_t GetTotalBytes() const;
+  // Оценка памяти edges записей в множествах рёбер графа
+  static MemoryStats ForEdges(size_t edges);
+
+  MemoryStats& operator+=(const MemoryStats& other);
+  MemoryStats& operator-=(const MemoryStats& other);
+};
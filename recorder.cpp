@@ -0,0 +1,227 @@
+#include "recorder.h"
+
+#include "sheet.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+namespace {
+const std::string TRACE_MAGIC = "ETR1";
+
+thread_local int call_depth = 0;
+
+void PutVarint(std::string& out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+// false, если данные закончились посреди числа
+bool GetVarint(const std::string& in, size_t& offset, uint64_t& value) {
+  value = 0;
+  for (int shift = 0; offset < in.size() && shift < 64; shift += 7) {
+    auto byte = static_cast<uint8_t>(in[offset++]);
+    value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool HasPosition(TraceOperation operation) {
+  return operation != TraceOperation::PRINT_VALUES &&
+         operation != TraceOperation::PRINT_TEXTS;
+}
+}  // namespace
+
+std::string_view TraceOperationName(TraceOperation operation) {
+  switch (operation) {
+    case TraceOperation::SET_CELL:
+      return "SetCell";
+    case TraceOperation::CLEAR_CELL:
+      return "ClearCell";
+    case TraceOperation::GET_VALUE:
+      return "GetValue";
+    case TraceOperation::PRINT_VALUES:
+      return "PrintValues";
+    case TraceOperation::PRINT_TEXTS:
+      return "PrintTexts";
+    case TraceOperation::INSERT_ROWS:
+      return "InsertRows";
+    case TraceOperation::INSERT_COLUMNS:
+      return "InsertColumns";
+    case TraceOperation::DELETE_ROWS:
+      return "DeleteRows";
+    case TraceOperation::DELETE_COLUMNS:
+      return "DeleteColumns";
+  }
+  return "Unknown";
+}
+
+WorkloadRecorder::CallScope::CallScope() { ++call_depth; }
+
+WorkloadRecorder::CallScope::~CallScope() { --call_depth; }
+
+bool WorkloadRecorder::CallScope::IsOutermost() const {
+  return call_depth == 1;
+}
+
+WorkloadRecorder::WorkloadRecorder(const std::string& path)
+    : file_(std::fopen(path.c_str(), "wb")),
+      start_(std::chrono::steady_clock::now()) {
+  if (!file_) {
+    throw TraceException("Failed to create trace " + path);
+  }
+  std::fwrite(TRACE_MAGIC.data(), 1, TRACE_MAGIC.size(), file_);
+}
+
+WorkloadRecorder::~WorkloadRecorder() { std::fclose(file_); }
+
+void WorkloadRecorder::Log(TraceOperation operation, Position pos,
+                           const std::string& text) {
+  auto time = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start_);
+  std::string record;
+  record.push_back(static_cast<char>(operation));
+  PutVarint(record, (time - last_time_).count());
+  last_time_ = time;
+  if (HasPosition(operation)) {
+    PutVarint(record, pos.row);
+    PutVarint(record, pos.col);
+  }
+  if (operation == TraceOperation::SET_CELL) {
+    PutVarint(record, text.size());
+    record += text;
+  }
+  if (std::fwrite(record.data(), 1, record.size(), file_) != record.size()) {
+    throw TraceException("Failed to write trace");
+  }
+}
+
+void WorkloadRecorder::Flush() {
+  if (std::fflush(file_) != 0) {
+    throw TraceException("Failed to flush trace");
+  }
+}
+
+std::vector<TraceRecord> WorkloadRecorder::Load(const std::string& path) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    throw TraceException("Failed to open trace " + path);
+  }
+  std::string data{std::istreambuf_iterator<char>(in),
+                   std::istreambuf_iterator<char>()};
+  if (data.compare(0, TRACE_MAGIC.size(), TRACE_MAGIC) != 0) {
+    throw TraceException("Not a workload trace: " + path);
+  }
+
+  std::vector<TraceRecord> records;
+  std::chrono::microseconds time{0};
+  size_t offset = TRACE_MAGIC.size();
+  while (offset < data.size()) {
+    TraceRecord record{static_cast<TraceOperation>(data[offset++]), {}, {0, 0},
+                       {}};
+    if (record.operation < TraceOperation::SET_CELL ||
+        record.operation > TraceOperation::DELETE_COLUMNS) {
+      throw TraceException("Corrupted trace: " + path);
+    }
+    uint64_t delta, row, col, length;
+    if (!GetVarint(data, offset, delta)) {
+      break;
+    }
+    time += std::chrono::microseconds(delta);
+    record.time = time;
+    if (HasPosition(record.operation)) {
+      if (!GetVarint(data, offset, row) || !GetVarint(data, offset, col)) {
+        break;
+      }
+      record.pos = {static_cast<int>(row), static_cast<int>(col)};
+    }
+    if (record.operation == TraceOperation::SET_CELL) {
+      if (!GetVarint(data, offset, length) || length > data.size() - offset) {
+        break;
+      }
+      record.text = data.substr(offset, length);
+      offset += length;
+    }
+    records.push_back(std::move(record));
+  }
+  return records;
+}
+
+std::chrono::nanoseconds ReplayTiming::Percentile(double fraction) const {
+  size_t rank = static_cast<size_t>(fraction * count);
+  size_t seen = 0;
+  for (size_t i = 0; i < buckets.size(); ++i) {
+    seen += buckets[i];
+    if (seen > rank || seen == count) {
+      return std::min(std::chrono::nanoseconds(int64_t{2} << i), max);
+    }
+  }
+  return max;
+}
+
+std::map<TraceOperation, ReplayTiming> ReplayTrace(
+    const std::vector<TraceRecord>& records, Sheet& sheet) {
+  std::map<TraceOperation, ReplayTiming> timings;
+  std::ostringstream sink;
+  for (const TraceRecord& record : records) {
+    ReplayTiming& timing = timings[record.operation];
+    auto start = std::chrono::steady_clock::now();
+    try {
+      switch (record.operation) {
+        case TraceOperation::SET_CELL:
+          sheet.SetCell(record.pos, record.text);
+          break;
+        case TraceOperation::CLEAR_CELL:
+          sheet.ClearCell(record.pos);
+          break;
+        case TraceOperation::GET_VALUE:
+          if (const CellInterface* cell = sheet.GetCell(record.pos)) {
+            cell->GetValue();
+          }
+          break;
+        case TraceOperation::PRINT_VALUES:
+          sheet.PrintValues(sink);
+          break;
+        case TraceOperation::PRINT_TEXTS:
+          sheet.PrintTexts(sink);
+          break;
+        case TraceOperation::INSERT_ROWS:
+          sheet.InsertRows(record.pos.row, record.pos.col);
+          break;
+        case TraceOperation::INSERT_COLUMNS:
+          sheet.InsertColumns(record.pos.row, record.pos.col);
+          break;
+        case TraceOperation::DELETE_ROWS:
+          sheet.DeleteRows(record.pos.row, record.pos.col);
+          break;
+        case TraceOperation::DELETE_COLUMNS:
+          sheet.DeleteColumns(record.pos.row, record.pos.col);
+          break;
+      }
+    } catch (const std::exception&) {
+      ++timing.errors;
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start);
+    sink.str({});
+
+    ++timing.count;
+    timing.total += elapsed;
+    timing.max = std::max(timing.max, elapsed);
+    size_t bucket = 0;
+    while (bucket + 1 < timing.buckets.size() &&
+           (int64_t{2} << bucket) <= elapsed.count()) {
+      ++bucket;
+    }
+    ++timing.buckets[bucket];
+  }
+  return timings;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "common.h"
+
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+class Sheet;
+
+// Исключение, выбрасываемое при ошибке чтения или записи трассы
+class TraceException : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+enum class TraceOperation {
+  SET_CELL,
+  CLEAR_CELL,
+  GET_VALUE,
+  PRINT_VALUES,
+  PRINT_TEXTS,
+  INSERT_ROWS,
+  INSERT_COLUMNS,
+  DELETE_ROWS,
+  DELETE_COLUMNS,
+};
+
+std::string_view TraceOperationName(TraceOperation operation);
+
+struct TraceRecord {
+  TraceOperation operation;
+  // Время вызова от начала записи
+  std::chrono::microseconds time;
+  // Для вставки и удаления строк (столбцов) row - первая строка (столбец),
+  // col - их количество
+  Position pos;
+  std::string text;
+};
+
+// Запись нагрузки на таблицу для воспроизведения. Таблица с подключённым
+// рекордером записывает вызовы SetCell, ClearCell, PrintValues, PrintTexts,
+// вставку и удаление строк и столбцов и GetValue ячеек с отметкой времени. Чтения, которые таблица выполняет
+// сама (формулы, печать, снимки), не записываются. Файл двоичный: тип
+// операции, приращение времени, позиция и текст в кодировке переменной
+// длины; недописанная последняя запись при чтении отбрасывается.
+class WorkloadRecorder {
+ public:
+  // Вызов таблицы, внутри которого обращения к ячейкам не записываются.
+  // Создаётся в начале каждой операции, которая может читать ячейки.
+  class CallScope {
+   public:
+    CallScope();
+    CallScope(const CallScope&) = delete;
+    CallScope& operator=(const CallScope&) = delete;
+    ~CallScope();
+
+    // Вызов сделан извне таблицы, а не из другой её операции
+    bool IsOutermost() const;
+  };
+
+  explicit WorkloadRecorder(const std::string& path);
+  WorkloadRecorder(const WorkloadRecorder&) = delete;
+  WorkloadRecorder& operator=(const WorkloadRecorder&) = delete;
+  ~WorkloadRecorder();
+
+  void Log(TraceOperation operation, Position pos = {0, 0},
+           const std::string& text = {});
+
+  // Сбрасывает буфер в файл
+  void Flush();
+
+  static std::vector<TraceRecord> Load(const std::string& path);
+
+ private:
+  std::FILE* file_ = nullptr;
+  std::chrono::steady_clock::time_point start_;
+  std::chrono::microseconds last_time_{0};
+};
+
+// Длительности операций одного типа при воспроизведении
+struct ReplayTiming {
+  size_t count = 0;
+  // Операции, бросившие исключение
+  size_t errors = 0;
+  std::chrono::nanoseconds total{0};
+  std::chrono::nanoseconds max{0};
+  // buckets[i] - число операций длительностью от 2^i до 2^(i+1) нс
+  std::array<size_t, 40> buckets{};
+
+  // Верхняя граница корзины, в которую попадает доля fraction операций
+  std::chrono::nanoseconds Percentile(double fraction) const;
+};
+
+// Выполняет записанные операции над sheet, замеряя каждую. Ошибки
+// отдельных операций не прерывают воспроизведение.
+std::map<TraceOperation, ReplayTiming> ReplayTrace(
+    const std::vector<TraceRecord>& records, Sheet& sheet);
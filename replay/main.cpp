@@ -0,0 +1,75 @@
+#include "recorder.h"
+#include "sheet.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+// Воспроизведение записанной нагрузки: spreadsheet_replay <трасса>.
+// Выполняет операции трассы над новой таблицей и печатает для каждого типа
+// операций число вызовов, суммарное время, перцентили и гистограмму
+// длительностей по степеням двойки.
+namespace {
+std::string FormatDuration(std::chrono::nanoseconds duration) {
+  std::ostringstream output;
+  output << std::fixed << std::setprecision(1);
+  if (duration.count() < 1000) {
+    output << duration.count() << "ns";
+  } else if (duration.count() < 1000000) {
+    output << duration.count() / 1e3 << "us";
+  } else {
+    output << duration.count() / 1e6 << "ms";
+  }
+  return output.str();
+}
+
+void PrintTiming(std::string_view name, const ReplayTiming& timing) {
+  std::cout << name << ": " << timing.count << " ops, " << timing.errors
+            << " errors, total " << FormatDuration(timing.total) << ", p50 <= "
+            << FormatDuration(timing.Percentile(0.5)) << ", p99 <= "
+            << FormatDuration(timing.Percentile(0.99)) << ", max "
+            << FormatDuration(timing.max) << '\n';
+  size_t widest = 0;
+  for (size_t bucket : timing.buckets) {
+    widest = std::max(widest, bucket);
+  }
+  for (size_t i = 0; i < timing.buckets.size(); ++i) {
+    if (timing.buckets[i] == 0) {
+      continue;
+    }
+    std::cout << "  < " << std::setw(8)
+              << FormatDuration(std::chrono::nanoseconds(int64_t{2} << i))
+              << ' ' << std::setw(8) << timing.buckets[i] << ' '
+              << std::string(timing.buckets[i] * 50 / widest + 1, '#')
+              << '\n';
+  }
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc != 2) {
+    std::cerr << "Usage: " << argv[0] << " <trace>\n";
+    return 2;
+  }
+  try {
+    auto records = WorkloadRecorder::Load(argv[1]);
+    Sheet sheet;
+    auto timings = ReplayTrace(records, sheet);
+    std::cout << "Replayed " << records.size() << " operations";
+    if (!records.empty()) {
+      std::cout << " recorded over "
+                << FormatDuration(records.back().time);
+    }
+    std::cout << '\n';
+    for (const auto& [operation, timing] : timings) {
+      PrintTiming(TraceOperationName(operation), timing);
+    }
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << '\n';
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,32 @@
+#include "calc_server.h"
+
+#include <atomic>
+#include <csignal>
+#include <exception>
+#include <iostream>
+
+namespace {
+std::atomic<bool> stop_requested = false;
+
+void RequestStop(int) { stop_requested = true; }
+}  // namespace
+
+// Сервер вычислений: spreadsheet_server <путь к сокету>. Завершается по
+// SIGINT или SIGTERM, дождавшись открытых соединений.
+int main(int argc, char* argv[]) {
+  if (argc != 2) {
+    std::cerr << "Usage: " << argv[0] << " <socket path>\n";
+    return 2;
+  }
+  std::signal(SIGINT, RequestStop);
+  std::signal(SIGTERM, RequestStop);
+
+  try {
+    CalcServer server;
+    server.ServeUnixSocket(argv[1], stop_requested);
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << '\n';
+    return 1;
+  }
+  return 0;
+}
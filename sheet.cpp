@@ -2,24 +2,72 @@
 
 #include "cell.h"
 #include "common.h"
+#include "tracing.h"
+#include "workbook.h"
 
 #include <algorithm>
+#include <atomic>
+#include <cstdlib>
 #include <functional>
 #include <iostream>
+#include <numeric>
 #include <optional>
 
 using namespace std::literals;
 
+namespace {
+// Запись индекса ссылок на пустые ячейки: узел хэш-таблицы с множеством
+// и указатель в массиве корзин
+const size_t REFERENCE_KEY_BYTES =
+    sizeof(std::pair<const PositionKey, std::set<Cell*>>) + 3 * sizeof(void*);
+
+// Пустая ячейка, на которую ссылаются формулы, видна через GetCell, хотя
+// объекта Cell для неё нет
+const SheetSnapshot::CellView EMPTY_REFERENCED_CELL("", 0.0, {});
+
+void CheckShiftCount(int count) {
+  if (count < 1) {
+    throw InvalidPositionException("Invalid number of rows or columns");
+  }
+}
+
+// Вставляет delta пустых элементов перед first или удаляет -delta элементов
+// начиная с first
+template <typename T>
+void ShiftElements(std::vector<T>& items, int first, int delta) {
+  if (first >= static_cast<int>(items.size())) {
+    return;
+  }
+  if (delta < 0) {
+    int last = std::min(first - delta, static_cast<int>(items.size()));
+    items.erase(items.begin() + first, items.begin() + last);
+    return;
+  }
+  items.resize(items.size() + delta);
+  std::move_backward(items.begin() + first, items.end() - delta, items.end());
+  for (int idx = first; idx < first + delta; ++idx) {
+    items[idx] = T();
+  }
+}
+}  // namespace
+
 Sheet::~Sheet() {}
 
 void Sheet::ResizeDataUpToPos(const Position& pos) {
+  MemoryStats::Usage& slots = memory_stats_.cell_slots;
   if (pos.row >= static_cast<int>(data_.size())) {
+    slots.bytes -= data_.capacity() * sizeof(data_[0]);
     data_.resize(pos.row + 1);
+    slots.bytes += data_.capacity() * sizeof(data_[0]);
     print_size_.rows = std::max(print_size_.rows, pos.row);
   }
   auto& row = data_.at(pos.row);
   if (pos.col >= static_cast<int>(row.size())) {
+    slots.count -= row.size();
+    slots.bytes -= row.capacity() * sizeof(row[0]);
     row.resize(pos.col + 1);
+    slots.count += row.size();
+    slots.bytes += row.capacity() * sizeof(row[0]);
     print_size_.cols = std::max(print_size_.cols, pos.col);
   }
 }
@@ -28,33 +76,81 @@ Cell* Sheet::GetCellPtr(const Position& ref_pos) {
   return data_[ref_pos.row][ref_pos.col].get();
 }
 
+Cell* Sheet::FindCell(Position pos) const {
+  if (pos.row < static_cast<int>(data_.size())) {
+    const auto& row = data_[pos.row];
+    if (pos.col < static_cast<int>(row.size())) {
+      return row[pos.col].get();
+    }
+  }
+  return nullptr;
+}
+
+Cell* Sheet::CreateCell(Position pos) {
+  ResizeDataUpToPos(pos);
+  auto& cell = data_[pos.row][pos.col];
+  if (!cell) {
+    cell = std::make_unique<Cell>(*this, pos);
+    auto it = empty_references_.find(PositionKey(pos));
+    if (it != empty_references_.end()) {
+      auto dependents = std::move(it->second);
+      empty_references_.erase(it);
+      MemoryStats usage = MemoryStats::ForEdges(dependents.size());
+      usage.dependency_edges.bytes += REFERENCE_KEY_BYTES;
+      RemoveMemoryUsage(usage);
+      for (Cell* dependent : dependents) {
+        dependent->LinkReferencedCell(cell.get());
+      }
+    }
+  }
+  return cell.get();
+}
+
 void Sheet::SetCell(Position pos, std::string text) {
   if (!pos.IsValid()) {
     throw InvalidPositionException("Invalid position");
   }
-  ResizeDataUpToPos(pos);
-  Cell* cell = GetCellPtr(pos);
-  if (cell == nullptr) {
-    data_[pos.row][pos.col] = std::make_unique<Cell>(*this);    
-    cell = GetCellPtr(pos);
+  TraceSpan span("Sheet::SetCell");
+  WorkloadRecorder::CallScope scope;
+  if (base_) {
+    MaterializeDependents(pos);
   }
+  Cell* cell = CreateCell(pos);
   cell->Set(text);
+  ++version_;
+  if (journal_) {
+    journal_->LogSet(pos, text);
+  }
+  if (recorder_) {
+    recorder_->Log(TraceOperation::SET_CELL, pos, text);
+  }
 }
 
 const CellInterface* Sheet::GetCell(Position pos) const {
   if (!pos.IsValid()) {
     throw InvalidPositionException("Invalid position");
   }
-
-  if (pos.row < static_cast<int>(data_.size())) {
-    auto& row = data_.at(pos.row);
-    if (pos.col < static_cast<int>(row.size())) {
-      auto& cell = row.at(pos.col);
-      if (cell) {
-        return cell.get();
-      }
+  if (const Cell* cell = FindCell(pos)) {
+    return cell;
+  }
+  if (base_) {
+    if (const CellInterface* cell = base_->GetCell(pos)) {
+      return cell;
     }
   }
+  if (empty_references_.count(PositionKey(pos)) != 0) {
+    return &EMPTY_REFERENCED_CELL;
+  }
+  return nullptr;
+}
+
+const CellInterface* Sheet::GetPrintableCell(Position pos) const {
+  if (const Cell* cell = FindCell(pos)) {
+    return cell->IsEmpty() ? nullptr : cell;
+  }
+  if (base_) {
+    return base_->GetCell(pos);
+  }
   return nullptr;
 }
 
@@ -78,6 +174,22 @@ void Sheet::UpdatePrintableSize() {
       }
     }
   }
+
+  if (base_) {
+    const auto& rows = base_->GetRows();
+    for (int row_idx = 0; row_idx < static_cast<int>(rows.size()); ++row_idx) {
+      if (!rows[row_idx]) {
+        continue;
+      }
+      const auto& row = *rows[row_idx];
+      for (int col_idx = 0; col_idx < static_cast<int>(row.size()); ++col_idx) {
+        if (row[col_idx] && !FindCell({row_idx, col_idx})) {
+          max_row = std::max(max_row, row_idx);
+          max_col = std::max(max_col, col_idx);
+        }
+      }
+    }
+  }
   print_size_ = {max_row, max_col};
 }
 
@@ -85,17 +197,664 @@ void Sheet::ClearCell(Position pos) {
   if (!pos.IsValid()) {
     throw InvalidPositionException("Invalid position");
   }
+  TraceSpan span("Sheet::ClearCell");
+  WorkloadRecorder::CallScope scope;
+  // Ячейка родительской таблицы остаётся пустой локальной ячейкой, которая
+  // закрывает собой значение из снимка
+  bool in_base = base_ && base_->GetCell(pos) != nullptr;
+  if (in_base) {
+    MaterializeDependents(pos);
+  }
 
   if (pos.row < static_cast<int>(data_.size())) {
     auto& row = data_.at(pos.row);
     if (pos.col < static_cast<int>(row.size())) {
       auto& cell = row.at(pos.col);
       if (cell) {
-        cell.reset();
+        // Зависимые ячейки должны увидеть пустое значение, а ячейки, на
+        // которые ссылалась формула, - забыть про неё. Ссылки на пустую
+        // ячейку переходят в индекс.
+        cell->Clear();
+        if (!in_base) {
+          std::vector<Cell*> dependents = cell->UnlinkDependents();
+          cell.reset();
+          for (Cell* dependent : dependents) {
+            GetCellForReference(pos, *dependent);
+          }
+        }
         UpdatePrintableSize();
+        ++version_;
+        if (journal_) {
+          journal_->LogClear(pos);
+        }
+        if (recorder_) {
+          recorder_->Log(TraceOperation::CLEAR_CELL, pos);
+        }
+      }
+    }
+  }
+}
+
+void Sheet::InsertRows(int before, int count) {
+  CheckShiftCount(count);
+  ShiftCells(Axis::ROWS, before, count);
+}
+
+void Sheet::InsertColumns(int before, int count) {
+  CheckShiftCount(count);
+  ShiftCells(Axis::COLUMNS, before, count);
+}
+
+void Sheet::DeleteRows(int first, int count) {
+  CheckShiftCount(count);
+  ShiftCells(Axis::ROWS, first, -count);
+}
+
+void Sheet::DeleteColumns(int first, int count) {
+  CheckShiftCount(count);
+  ShiftCells(Axis::COLUMNS, first, -count);
+}
+
+void Sheet::ShiftCells(Axis axis, int first, int delta) {
+  const int limit =
+      axis == Axis::ROWS ? Position::MAX_ROWS : Position::MAX_COLS;
+  if (first < 0 || first >= limit || std::abs(delta) > limit - first) {
+    throw InvalidPositionException("Invalid position");
+  }
+  TraceSpan span("Sheet::ShiftCells");
+  WorkloadRecorder::CallScope scope;
+  if (base_) {
+    DetachBase();
+  }
+
+  auto coord = [axis](const Position& pos) {
+    return axis == Axis::ROWS ? pos.row : pos.col;
+  };
+  // Новая позиция ячейки; NONE для удалённой или вытолкнутой за край
+  const std::function<Position(Position)> rewrite = [&](Position pos) {
+    if (!pos.IsValid() || coord(pos) < first) {
+      return pos;
+    }
+    if (coord(pos) < first - delta) {
+      return Position::NONE;
+    }
+    (axis == Axis::ROWS ? pos.row : pos.col) += delta;
+    return coord(pos) < limit ? pos : Position::NONE;
+  };
+
+  // Затрагиваются только строки (столбцы) начиная с first
+  auto for_each_shifted = [&](auto&& visit) {
+    int first_row = axis == Axis::ROWS ? first : 0;
+    int first_col = axis == Axis::ROWS ? 0 : first;
+    for (int row_idx = first_row; row_idx < static_cast<int>(data_.size());
+         ++row_idx) {
+      auto& row = data_[row_idx];
+      for (int col_idx = first_col; col_idx < static_cast<int>(row.size());
+           ++col_idx) {
+        if (row[col_idx]) {
+          visit(*row[col_idx], Position{row_idx, col_idx});
+        }
+      }
+    }
+  };
+
+  std::vector<Cell*> removed;
+  for_each_shifted([&](Cell& cell, Position pos) {
+    if (!rewrite(pos).IsValid()) {
+      if (delta > 0) {
+        throw InvalidPositionException("Cells would be shifted off the sheet");
+      }
+      removed.push_back(&cell);
+    }
+  });
+
+  // Формулы, ссылающиеся на сдвигаемые ячейки. Ссылки на удалённые ячейки
+  // разрываются: после перезаписи на их месте #REF!.
+  std::set<Cell*> referencing;
+  for (Cell* cell : removed) {
+    cell->Clear();
+    for (Cell* dependent : cell->UnlinkDependents()) {
+      referencing.insert(dependent);
+    }
+  }
+  std::vector<Position> shifted;
+  for_each_shifted([&](Cell& cell, Position pos) {
+    const std::set<Cell*>& dependents = cell.GetDependentCells();
+    referencing.insert(dependents.begin(), dependents.end());
+    shifted.push_back(pos);
+  });
+  std::vector<decltype(empty_references_)::node_type> moved_references;
+  for (auto it = empty_references_.begin(); it != empty_references_.end();) {
+    Position pos = it->first.ToPosition();
+    if (coord(pos) < first) {
+      ++it;
+      continue;
+    }
+    referencing.insert(it->second.begin(), it->second.end());
+    auto node = empty_references_.extract(it++);
+    if (Position target = rewrite(pos); target.IsValid()) {
+      node.key() = PositionKey(target);
+      moved_references.push_back(std::move(node));
+    } else {
+      MemoryStats usage = MemoryStats::ForEdges(node.mapped().size());
+      usage.dependency_edges.bytes += REFERENCE_KEY_BYTES;
+      RemoveMemoryUsage(usage);
+    }
+  }
+  for (auto& node : moved_references) {
+    empty_references_.insert(std::move(node));
+  }
+  for (Cell* cell : removed) {
+    referencing.erase(cell);
+  }
+
+  if (axis == Axis::ROWS) {
+    ShiftElements(data_, first, delta);
+    data_.resize(std::min(data_.size(), static_cast<size_t>(limit)));
+  } else {
+    for (auto& row : data_) {
+      ShiftElements(row, first, delta);
+      row.resize(std::min(row.size(), static_cast<size_t>(limit)));
+    }
+  }
+  MemoryStats::Usage& slots = memory_stats_.cell_slots;
+  slots.count = 0;
+  slots.bytes = data_.capacity() * sizeof(data_[0]);
+  for (const auto& row : data_) {
+    slots.count += row.size();
+    slots.bytes += row.capacity() * sizeof(row[0]);
+  }
+  for_each_shifted([&](Cell& cell, Position pos) {
+    cell.MoveTo(pos);
+    shifted.push_back(pos);
+  });
+  // До перезаписи формул: сброс их кэша пишется в профиль по новым позициям
+  if (profile_) {
+    profile_->RewritePositions(rewrite);
+  }
+
+  if (snapshot_) {
+    snapshot_layout_changed_ = true;
+    snapshot_dirty_cells_.clear();
+    for_each_shifted([&](Cell&, Position pos) {
+      snapshot_dirty_cells_.insert(PositionKey(pos));
+    });
+  }
+
+  shared_subexpressions_.RewriteCells(rewrite);
+  if (value_cache_) {
+    value_cache_->RewritePinned(rewrite);
+  }
+  for (Cell* cell : referencing) {
+    cell->RewriteReferences(*this, rewrite);
+  }
+
+  UpdatePrintableSize();
+  ++version_;
+  if (track_changes_) {
+    // Прежние значения записаны по старым позициям, поэтому все позиции
+    // в сдвинутой части считаются изменёнными
+    for (auto& [key, previous] : pending_changes_) {
+      if (coord(key.ToPosition()) >= first) {
+        previous.known = false;
+      }
+    }
+    for (Position pos : shifted) {
+      pending_changes_[PositionKey(pos)].known = false;
+    }
+  }
+  const int count = std::abs(delta);
+  if (journal_) {
+    if (axis == Axis::ROWS && delta > 0) {
+      journal_->LogInsertRows(first, count);
+    } else if (axis == Axis::ROWS) {
+      journal_->LogDeleteRows(first, count);
+    } else if (delta > 0) {
+      journal_->LogInsertColumns(first, count);
+    } else {
+      journal_->LogDeleteColumns(first, count);
+    }
+  }
+  if (recorder_) {
+    TraceOperation operation =
+        axis == Axis::ROWS
+            ? (delta > 0 ? TraceOperation::INSERT_ROWS
+                         : TraceOperation::DELETE_ROWS)
+            : (delta > 0 ? TraceOperation::INSERT_COLUMNS
+                         : TraceOperation::DELETE_COLUMNS);
+    recorder_->Log(operation, {first, count});
+  }
+}
+
+void Sheet::SetDeferredParsing(bool enabled) { deferred_parsing_ = enabled; }
+
+bool Sheet::IsDeferredParsing() const { return deferred_parsing_; }
+
+void Sheet::SetSubexpressionSharing(bool enabled) {
+  share_subexpressions_ = enabled;
+}
+
+SharedSubexpressions* Sheet::GetSharedSubexpressions() {
+  return share_subexpressions_ ? &shared_subexpressions_ : nullptr;
+}
+
+void Sheet::ValidateFormulas() const {
+  for (int row_idx = 0; row_idx < static_cast<int>(data_.size()); ++row_idx) {
+    const auto& row = data_.at(row_idx);
+    for (int col_idx = 0; col_idx < static_cast<int>(row.size()); ++col_idx) {
+      const auto& cell = row.at(col_idx);
+      if (!cell) {
+        continue;
+      }
+      try {
+        cell->Validate();
+      } catch (const FormulaException&) {
+        throw FormulaException("Failed to parse formula in " +
+                               Position{row_idx, col_idx}.ToString());
+      }
+    }
+  }
+}
+
+void Sheet::AttachJournal(ChangeJournal* journal) { journal_ = journal; }
+
+MemoryStats Sheet::GetMemoryStats() const {
+  MemoryStats stats = memory_stats_;
+  stats.texts += string_pool_.GetUsage();
+  return stats;
+}
+
+StringPool& Sheet::GetStringPool() { return string_pool_; }
+
+void Sheet::AddMemoryUsage(const MemoryStats& usage) {
+  memory_stats_ += usage;
+}
+
+void Sheet::RemoveMemoryUsage(const MemoryStats& usage) {
+  memory_stats_ -= usage;
+}
+
+void Sheet::AttachRecorder(WorkloadRecorder* recorder) {
+  recorder_ = recorder;
+}
+
+WorkloadRecorder* Sheet::GetRecorder() const { return recorder_; }
+
+void Sheet::SetProfiling(bool enabled) {
+  profile_ = enabled ? std::make_unique<SheetProfile>() : nullptr;
+}
+
+SheetProfile Sheet::GetProfile() const {
+  return profile_ ? *profile_ : SheetProfile();
+}
+
+SheetProfile* Sheet::GetProfiler() const { return profile_.get(); }
+
+void Sheet::SetValueCacheBudget(std::optional<size_t> budget_bytes) {
+  if (!budget_bytes) {
+    value_cache_.reset();
+    return;
+  }
+  if (value_cache_) {
+    value_cache_->SetBudget(*budget_bytes);
+    return;
+  }
+  value_cache_ = std::make_unique<ValueCache>(*budget_bytes);
+  for (const auto& row : data_) {
+    for (const auto& cell : row) {
+      if (cell && cell->HoldsFormulaValue()) {
+        value_cache_->Insert(cell.get());
+      }
+    }
+  }
+}
+
+void Sheet::SetValuePinned(Position pos, bool pinned) {
+  if (!pos.IsValid()) {
+    throw InvalidPositionException("Invalid position");
+  }
+  if (value_cache_) {
+    value_cache_->SetPinned(pos, pinned);
+  }
+}
+
+ValueCache* Sheet::GetValueCache() const { return value_cache_.get(); }
+
+void Sheet::SetChangeTracking(bool enabled) {
+  track_changes_ = enabled;
+  pending_changes_.clear();
+}
+
+std::vector<Position> Sheet::TakeChanges() {
+  WorkloadRecorder::CallScope scope;
+  std::vector<Position> result;
+  for (const auto& [key, previous] : pending_changes_) {
+    Position pos = key.ToPosition();
+    if (!previous.known ||
+        !(previous.value == GetVisibleValue(FindCell(pos)))) {
+      result.push_back(pos);
+    }
+  }
+  pending_changes_.clear();
+  return result;
+}
+
+void Sheet::SetEagerRecalculation(bool enabled) {
+  eager_recalculation_ = enabled;
+}
+
+bool Sheet::IsEagerRecalculation() const { return eager_recalculation_; }
+
+void Sheet::NoteValueChange(const Cell& cell) {
+  // Значения общих подвыражений могли зависеть от этой ячейки
+  shared_subexpressions_.NextEpoch();
+  Position pos = cell.GetPosition();
+  if (snapshot_) {
+    snapshot_dirty_cells_.insert(PositionKey(pos));
+  }
+  if (!track_changes_) {
+    return;
+  }
+  if (pending_changes_.count(PositionKey(pos)) != 0) {
+    return;
+  }
+  PreviousValue previous;
+  if (cell.HasCachedValue()) {
+    previous.known = true;
+    previous.value = GetVisibleValue(&cell);
+  }
+  pending_changes_.emplace(PositionKey(pos), std::move(previous));
+}
+
+Sheet::VisibleValue Sheet::GetVisibleValue(const Cell* cell) const {
+  if (cell == nullptr || cell->IsEmpty()) {
+    return std::nullopt;
+  }
+  return cell->GetValue();
+}
+
+std::shared_ptr<const SheetSnapshot::CellView> Sheet::MakeCellView(
+    const Cell* cell) const {
+  if (cell == nullptr || cell->IsEmpty()) {
+    return nullptr;
+  }
+  return std::make_shared<const SheetSnapshot::CellView>(
+      cell->GetText(), cell->GetValue(), cell->GetReferencedCells());
+}
+
+std::shared_ptr<const SheetSnapshot> Sheet::Snapshot() {
+  return BuildSnapshot(false);
+}
+
+std::shared_ptr<const SheetSnapshot> Sheet::SnapshotSettled() {
+  return BuildSnapshot(true);
+}
+
+std::shared_ptr<const SheetSnapshot> Sheet::BuildSnapshot(bool settled_only) {
+  TraceSpan span("Sheet::Snapshot");
+  WorkloadRecorder::CallScope scope;
+  if (snapshot_ && snapshot_dirty_cells_.empty() &&
+      !snapshot_layout_changed_) {
+    return snapshot_;
+  }
+
+  // После сдвига строк или столбцов прежние строки снимка не подходят
+  bool rebuild = !snapshot_ || snapshot_layout_changed_;
+  snapshot_layout_changed_ = false;
+  SheetSnapshot::Rows rows;
+  if (!rebuild) {
+    rows = snapshot_->GetRows();
+  }
+  rows.resize(std::max(rows.size(), data_.size()));
+
+  // Невычисленные формулы остаются в снимке с прежним значением и будут
+  // перестроены следующим снимком
+  std::set<PositionKey> unsettled;
+  auto update_row = [&](int row_idx, auto&& cols) {
+    const auto& data_row = data_.at(row_idx);
+    auto row = rows[row_idx]
+                   ? std::make_shared<SheetSnapshot::Row>(*rows[row_idx])
+                   : std::make_shared<SheetSnapshot::Row>();
+    row->resize(std::max(row->size(), data_row.size()));
+    for (int col_idx : cols) {
+      const Cell* cell = data_row.at(col_idx).get();
+      if (settled_only && cell && !cell->HasCachedValue()) {
+        unsettled.insert(PositionKey({row_idx, col_idx}));
+        continue;
+      }
+      (*row)[col_idx] = MakeCellView(cell);
+    }
+    rows[row_idx] = std::move(row);
+  };
+
+  if (rebuild) {
+    for (int row_idx = 0; row_idx < static_cast<int>(data_.size()); ++row_idx) {
+      std::vector<int> cols(data_[row_idx].size());
+      std::iota(cols.begin(), cols.end(), 0);
+      update_row(row_idx, cols);
+    }
+  } else {
+    std::vector<int> cols;
+    auto it = snapshot_dirty_cells_.begin();
+    while (it != snapshot_dirty_cells_.end()) {
+      int row_idx = it->ToPosition().row;
+      cols.clear();
+      for (; it != snapshot_dirty_cells_.end() &&
+             it->ToPosition().row == row_idx;
+           ++it) {
+        cols.push_back(it->ToPosition().col);
       }
+      update_row(row_idx, cols);
+    }
+  }
+  snapshot_dirty_cells_ = std::move(unsettled);
+
+  auto snapshot = std::make_shared<const SheetSnapshot>(
+      std::move(rows), GetPrintableSize(), version_,
+      snapshot_dirty_cells_.empty());
+  std::atomic_store(&snapshot_, snapshot);
+  return snapshot;
+}
+
+bool Sheet::EvaluateWithin(const std::vector<Position>& positions,
+                           const EvaluationLimit& limit,
+                           std::vector<Position>* settled) const {
+  TraceSpan span("Sheet::EvaluateWithin");
+  WorkloadRecorder::CallScope scope;
+  for (Position pos : positions) {
+    if (!pos.IsValid()) {
+      throw InvalidPositionException("Invalid position");
+    }
+    const Cell* cell = FindCell(pos);
+    if (cell && !cell->Evaluate(limit, settled)) {
+      return false;
     }
   }
+  return true;
+}
+
+Sheet::BoundedValue Sheet::GetValueWithin(Position pos,
+                                          const EvaluationLimit& limit) const {
+  BoundedValue result;
+  result.stale = !EvaluateWithin({pos}, limit);
+  if (GetPrintableCell(pos)) {
+    result.value = GetLastValue(pos);
+  }
+  return result;
+}
+
+std::optional<CellInterface::Value> Sheet::GetLastValue(Position pos) const {
+  if (const Cell* cell = FindCell(pos)) {
+    return cell->GetLastValue();
+  }
+  if (base_) {
+    if (const CellInterface* cell = base_->GetCell(pos)) {
+      return cell->GetValue();
+    }
+  }
+  return std::nullopt;
+}
+
+void Sheet::AttachWorkbook(Workbook* workbook) { workbook_ = workbook; }
+
+const SheetInterface* Sheet::FindSheet(std::string_view name) const {
+  return GetWorkbookSheet(name);
+}
+
+Sheet* Sheet::GetWorkbookSheet(std::string_view name) const {
+  return workbook_ ? workbook_->GetSheet(name) : nullptr;
+}
+
+std::set<std::string, std::less<>> Sheet::GetReferencedSheets() const {
+  std::set<std::string, std::less<>> result;
+  for (const auto& row : data_) {
+    for (const auto& cell : row) {
+      if (!cell) {
+        continue;
+      }
+      for (const SheetPosition& ref : cell->GetSheetReferences()) {
+        result.insert(ref.sheet);
+      }
+    }
+  }
+  return result;
+}
+
+void Sheet::Recalculate() const {
+  WorkloadRecorder::CallScope scope;
+  for (const auto& row : data_) {
+    for (const auto& cell : row) {
+      if (cell) {
+        cell->GetValue();
+      }
+    }
+  }
+}
+
+std::unique_ptr<Sheet> Sheet::Fork() {
+  auto fork = std::make_unique<Sheet>();
+  fork->base_ = Snapshot();
+  fork->snapshot_ = fork->base_;
+  Size size = fork->base_->GetPrintableSize();
+  fork->print_size_ = {size.rows - 1, size.cols - 1};
+  fork->deferred_parsing_ = deferred_parsing_;
+  fork->share_subexpressions_ = share_subexpressions_;
+  fork->eager_recalculation_ = eager_recalculation_;
+  fork->version_ = version_;
+  return fork;
+}
+
+Cell* Sheet::GetCellForReference(Position pos, Cell& dependent) {
+  if (Cell* cell = FindCell(pos)) {
+    return cell;
+  }
+  if (base_ && base_->GetCell(pos)) {
+    // Значение из снимка верно, пока ячейку не затронет правка; тогда она
+    // будет перенесена в таблицу и получит ребро к dependent
+    base_references_[PositionKey(pos)].insert(&dependent);
+    return nullptr;
+  }
+  auto [it, inserted] = empty_references_.try_emplace(PositionKey(pos));
+  if (it->second.insert(&dependent).second) {
+    MemoryStats usage = MemoryStats::ForEdges(1);
+    usage.dependency_edges.bytes += inserted ? REFERENCE_KEY_BYTES : 0;
+    AddMemoryUsage(usage);
+  }
+  return nullptr;
+}
+
+void Sheet::UnlinkReferences(Cell& cell,
+                             const std::vector<Position>& positions) {
+  for (Position pos : positions) {
+    if (!pos.IsValid()) {
+      continue;
+    }
+    if (auto it = base_references_.find(PositionKey(pos));
+        it != base_references_.end()) {
+      it->second.erase(&cell);
+      if (it->second.empty()) {
+        base_references_.erase(it);
+      }
+    }
+    auto it = empty_references_.find(PositionKey(pos));
+    if (it != empty_references_.end() && it->second.erase(&cell) != 0) {
+      MemoryStats usage = MemoryStats::ForEdges(1);
+      if (it->second.empty()) {
+        empty_references_.erase(it);
+        usage.dependency_edges.bytes += REFERENCE_KEY_BYTES;
+      }
+      RemoveMemoryUsage(usage);
+    }
+  }
+}
+
+Cell* Sheet::Materialize(Position pos, const CellInterface& base_cell) {
+  Cell* cell = CreateCell(pos);
+  cell->Restore(base_cell);
+
+  auto it = base_references_.find(PositionKey(pos));
+  if (it != base_references_.end()) {
+    auto dependents = std::move(it->second);
+    base_references_.erase(it);
+    for (Cell* dependent : dependents) {
+      dependent->LinkReferencedCell(cell);
+    }
+  }
+  return cell;
+}
+
+void Sheet::DetachBase() {
+  const auto& rows = base_->GetRows();
+  for (int row_idx = 0; row_idx < static_cast<int>(rows.size()); ++row_idx) {
+    if (!rows[row_idx]) {
+      continue;
+    }
+    const auto& row = *rows[row_idx];
+    for (int col_idx = 0; col_idx < static_cast<int>(row.size()); ++col_idx) {
+      if (row[col_idx] && !FindCell({row_idx, col_idx})) {
+        Materialize({row_idx, col_idx}, *row[col_idx]);
+      }
+    }
+  }
+  base_.reset();
+}
+
+void Sheet::MaterializeDependents(Position pos) {
+  // Переносим из снимка ячейку и все ячейки, значения которых от неё
+  // зависят. Ячейки, уже перенесённые раньше, перенесли вместе со своими
+  // зависимыми, поэтому дальше них обход не идёт.
+  if (!FindCell(pos)) {
+    if (const CellInterface* base_cell = base_->GetCell(pos)) {
+      Materialize(pos, *base_cell);
+    }
+  }
+  std::vector<Position> worklist{pos};
+  while (!worklist.empty()) {
+    Position current = worklist.back();
+    worklist.pop_back();
+    for (Position dependent : base_->GetDependentCells(current)) {
+      if (FindCell(dependent)) {
+        continue;
+      }
+      Materialize(dependent, *base_->GetCell(dependent));
+      worklist.push_back(dependent);
+    }
+  }
+}
+
+std::shared_ptr<const SheetSnapshot> Sheet::GetPublishedSnapshot() const {
+  return std::atomic_load(&snapshot_);
+}
+
+uint64_t Sheet::GetVersion() const { return version_; }
+
+std::vector<Position> Sheet::GetUnpublishedCells() const {
+  std::vector<Position> result;
+  result.reserve(snapshot_dirty_cells_.size());
+  for (PositionKey key : snapshot_dirty_cells_) {
+    result.push_back(key.ToPosition());
+  }
+  return result;
 }
 
 Size Sheet::GetPrintableSize() const {
@@ -103,23 +862,42 @@ Size Sheet::GetPrintableSize() const {
 }
 
 void Sheet::PrintData(std::ostream& output, PrintType print_type) const {
+  TraceSpan span("Sheet::Print");
+  WorkloadRecorder::CallScope scope;
   for (int row_idx = 0; row_idx < print_size_.rows + 1; ++row_idx) {
     for (int col_idx = 0; col_idx < print_size_.cols + 1; ++col_idx) {
       if (col_idx != 0) {
         output << '\t';
       }
-      const auto& row = data_.at(row_idx);
-      if (col_idx < static_cast<int>(row.size())) {
-        const auto& cell = row.at(col_idx);
-        if (cell) {
-          switch (print_type) {
-            case PrintType::VALUES:
-              output << cell->GetValue();
-              break;
-            case PrintType::TEXT:
-              output << cell->GetText();
-              break;
-          }
+      const CellInterface* cell = GetPrintableCell({row_idx, col_idx});
+      // Текст ячейки таблицы печатается без копирования строки
+      const Cell* local = FindCell({row_idx, col_idx});
+      if (local && local->IsEmpty() && print_type == PrintType::VALUES) {
+        output << local->GetValue();
+        continue;
+      }
+      if (local && print_type != PrintType::LAST_VALUES) {
+        std::optional<std::string_view> text =
+            print_type == PrintType::TEXT ? local->GetTextView()
+                                          : local->GetTextValueView();
+        if (text) {
+          output << *text;
+          continue;
+        }
+      }
+      if (cell) {
+        switch (print_type) {
+          case PrintType::VALUES:
+            output << cell->GetValue();
+            break;
+          case PrintType::TEXT:
+            output << cell->GetText();
+            break;
+          case PrintType::LAST_VALUES:
+            if (auto value = GetLastValue({row_idx, col_idx})) {
+              output << *value;
+            }
+            break;
         }
       }
     }
@@ -129,10 +907,31 @@ void Sheet::PrintData(std::ostream& output, PrintType print_type) const {
 
 void Sheet::PrintValues(std::ostream& output) const {
   PrintData(output, PrintType::VALUES);
+  if (recorder_) {
+    recorder_->Log(TraceOperation::PRINT_VALUES);
+  }
+}
+
+bool Sheet::PrintValuesWithin(std::ostream& output,
+                              const EvaluationLimit& limit) const {
+  std::vector<Position> positions;
+  for (int row_idx = 0; row_idx <= print_size_.rows; ++row_idx) {
+    for (int col_idx = 0; col_idx <= print_size_.cols; ++col_idx) {
+      if (FindCell({row_idx, col_idx})) {
+        positions.push_back({row_idx, col_idx});
+      }
+    }
+  }
+  bool complete = EvaluateWithin(positions, limit);
+  PrintData(output, PrintType::LAST_VALUES);
+  return complete;
 }
 
 void Sheet::PrintTexts(std::ostream& output) const {
   PrintData(output, PrintType::TEXT);
+  if (recorder_) {
+    recorder_->Log(TraceOperation::PRINT_TEXTS);
+  }
 }
 
 std::unique_ptr<SheetInterface> CreateSheet() {
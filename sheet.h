@@ -2,8 +2,22 @@
 
 #include "cell.h"
 #include "common.h"
+#include "journal.h"
+#include "memory_stats.h"
+#include "recorder.h"
+#include "sheet_profile.h"
+#include "sheet_snapshot.h"
+#include "string_pool.h"
+#include "value_cache.h"
 
+#include <cstdint>
 #include <functional>
+#include <map>
+#include <optional>
+#include <set>
+#include <unordered_map>
+
+class Workbook;
 
 class Sheet : public SheetInterface {
  public:
@@ -27,13 +41,225 @@ class Sheet : public SheetInterface {
 
   Cell* GetCellPtr(const Position& ref_pos);
 
+  // Вставляют count пустых строк (столбцов) перед строкой (столбцом) before
+  // и удаляют count строк (столбцов) начиная с first. Ячейки сдвигаются
+  // вместе с рёбрами графа, а в формулах, которые ссылаются на сдвинутые
+  // ячейки, позиции переписываются без повторного разбора. Ссылки на
+  // удалённые ячейки становятся #REF!. Бросают InvalidPositionException для
+  // некорректных аргументов и если вставка вытолкнет ячейки за край таблицы.
+  // Копия из Fork() при первом таком изменении переносит в себя все ячейки
+  // родительского снимка.
+  void InsertRows(int before, int count = 1);
+  void InsertColumns(int before, int count = 1);
+  void DeleteRows(int first, int count = 1);
+  void DeleteColumns(int first, int count = 1);
+
+  // В режиме отложенного разбора SetCell сохраняет текст формулы и только
+  // ищет в нём ссылки на ячейки: этого хватает для графа зависимостей и
+  // проверки циклов. AST строится при первом вычислении. Синтаксическая
+  // ошибка обнаруживается в ValidateFormulas() или при обращении к значению.
+  void SetDeferredParsing(bool enabled);
+  bool IsDeferredParsing() const;
+
+  // Разбирает все отложенные формулы. Бросает FormulaException с позицией
+  // первой некорректной формулы.
+  void ValidateFormulas() const;
+
+  // Общие подвыражения: одинаковые части формул, которые ссылаются только на
+  // ячейки этой таблицы, вычисляются один раз до ближайшей правки, меняющей
+  // значения. Действует на формулы, разобранные после включения.
+  void SetSubexpressionSharing(bool enabled);
+  // Пул общих подвыражений для новых формул или nullptr, если выключено
+  SharedSubexpressions* GetSharedSubexpressions();
+
+  // Подключает журнал, в который записываются успешные SetCell, ClearCell,
+  // вставки и удаления строк и столбцов.
+  // Журнал должен жить дольше таблицы либо быть отключён передачей nullptr.
+  void AttachJournal(ChangeJournal* journal);
+
+  // Подключает запись нагрузки: вызовы SetCell, ClearCell, Print* и GetValue
+  // ячеек этой таблицы. Рекордер должен жить дольше таблицы либо быть
+  // отключён передачей nullptr. Чтения из снимков не записываются.
+  void AttachRecorder(WorkloadRecorder* recorder);
+  WorkloadRecorder* GetRecorder() const;
+
+  // Профилирование пересчёта: число и время вычислений, попадания в кэш,
+  // разбор формул и сброс кэша зависимых при правках по каждой ячейке.
+  // Включение начинает новый профиль. Выключенное профилирование стоит одной
+  // проверки указателя на вычисление.
+  void SetProfiling(bool enabled);
+  // Копия собранного профиля; пустой, если профилирование выключено
+  SheetProfile GetProfile() const;
+  // Профиль, в который ячейки пишут замеры, или nullptr
+  SheetProfile* GetProfiler() const;
+
+  // Ограничивает память под вычисленные значения формул: редко читаемые
+  // значения вытесняются и вычисляются заново при следующем чтении.
+  // nullopt снимает ограничение (по умолчанию) вместе с закреплениями.
+  void SetValueCacheBudget(std::optional<size_t> budget_bytes);
+  // Закреплённые значения не вытесняются; действует, пока задан бюджет
+  void SetValuePinned(Position pos, bool pinned);
+  // Кэш значений с бюджетом или nullptr
+  ValueCache* GetValueCache() const;
+
+  // Лента изменений. Пока она включена, таблица запоминает прежние видимые
+  // значения ячеек, которые затрагивает редактирование (сама ячейка и все
+  // зависящие от неё). TakeChanges() возвращает отсортированный список
+  // позиций, видимое значение которых с прошлого вызова действительно
+  // изменилось, и начинает новый пакет. Прежнее значение формулы известно,
+  // только если она была вычислена; иначе ячейка считается изменённой.
+  // Поэтому в режиме немедленного пересчёта формула, которая при включении
+  // ленты была невычисленной или устаревшей, попадает в первый затронувший
+  // её пакет, даже если её значение не изменилось. В ленивом режиме такая
+  // формула в пакет не попадает: сброс кэша через неё не проходит. Чтобы
+  // лента была точной с самого начала, вычислите формулы до её включения.
+  void SetChangeTracking(bool enabled);
+  std::vector<Position> TakeChanges();
+
+  // В режиме немедленного пересчёта редактирование сразу вычисляет новое
+  // значение ячейки и пересчитывает зависимые только в том случае, если
+  // значение какой-то из их ячеек-аргументов действительно изменилось.
+  // Иначе кэш всех зависимых ячеек сбрасывается и они вычисляются лениво.
+  void SetEagerRecalculation(bool enabled);
+  bool IsEagerRecalculation() const;
+
+  // Создаёт неизменяемый снимок таблицы с вычисленными значениями и
+  // публикует его для читателей. Вызывается из потока, который редактирует
+  // таблицу; заново строятся только строки, изменившиеся с прошлого снимка.
+  std::shared_ptr<const SheetSnapshot> Snapshot();
+  // Как Snapshot(), но не вычисляет формулы: ячейки без актуального значения
+  // остаются в снимке с прежним значением, а снимок помечается неполным
+  std::shared_ptr<const SheetSnapshot> SnapshotSettled();
+  // Последний опубликованный снимок или nullptr. Можно вызывать из любого
+  // потока одновременно с редактированием.
+  std::shared_ptr<const SheetSnapshot> GetPublishedSnapshot() const;
+  // Номер правки: увеличивается при каждом успешном SetCell и ClearCell,
+  // вставке и удалении строк и столбцов
+  uint64_t GetVersion() const;
+  // Ячейки, значения которых могли измениться после последнего Snapshot()
+  std::vector<Position> GetUnpublishedCells() const;
+
+  // Вычисление с ограничением по времени или с отменой. Вычисленные значения
+  // остаются в кэше, поэтому повторный вызов продолжает с того места, где
+  // остановился предыдущий. Позиции вычисленных ячеек добавляются в settled.
+  // Возвращает true, если вычислены все ячейки positions.
+  bool EvaluateWithin(const std::vector<Position>& positions,
+                      const EvaluationLimit& limit,
+                      std::vector<Position>* settled = nullptr) const;
+
+  struct BoundedValue {
+    // nullopt для пустой ячейки и для формулы, которая ещё не вычислялась
+    std::optional<CellInterface::Value> value;
+    // Значение вычислено до последних правок и может быть неактуальным
+    bool stale = false;
+  };
+  // Вычисляет ячейку в пределах limit; если не успевает, возвращает
+  // последнее известное значение с пометкой stale
+  BoundedValue GetValueWithin(Position pos, const EvaluationLimit& limit) const;
+  // Как PrintValues, но не вычисляет дольше limit: для невычисленных ячеек
+  // печатаются последние известные значения. Возвращает false, если
+  // напечатано хотя бы одно устаревшее значение.
+  bool PrintValuesWithin(std::ostream& output,
+                         const EvaluationLimit& limit) const;
+
+  // Создаёт копию таблицы для сценариев "что если": копия читает тексты и
+  // значения из общего с родителем снимка. Копирования ячеек нет, но снимок
+  // строится вызовом Snapshot(): вычисляются все формулы без актуального
+  // значения и перестраиваются строки, изменённые с прошлого снимка. Если
+  // родитель не менялся после Snapshot(), копия создаётся за O(1). При
+  // правке в копию переносятся изменённая ячейка и зависящие от неё; их
+  // формулы разбираются заново из текста, AST с родителем не разделяются.
+  // Копия не зависит от дальнейших правок родителя и не входит в книгу:
+  // в перенесённых формулах ссылки на другие листы дают #REF!.
+  std::unique_ptr<Sheet> Fork();
+
+  // Возвращает ячейку, на которую ссылается формула dependent. nullptr, если
+  // ячейки нет или она пока читается из снимка родительской таблицы: связь
+  // запоминается и появится, когда ячейку создадут или перенесут в копию.
+  Cell* GetCellForReference(Position pos, Cell& dependent);
+  // Забывает отложенные связи формулы cell с ячейками positions
+  void UnlinkReferences(Cell& cell, const std::vector<Position>& positions);
+
+  // Подключает таблицу к книге, листы которой доступны в формулах по имени.
+  // Вызывается Workbook при добавлении листа.
+  void AttachWorkbook(Workbook* workbook);
+  const SheetInterface* FindSheet(std::string_view name) const override;
+  Sheet* GetWorkbookSheet(std::string_view name) const;
+  // Имена листов, на которые ссылаются формулы этой таблицы
+  std::set<std::string, std::less<>> GetReferencedSheets() const;
+  // Вычисляет значения всех ячеек таблицы
+  void Recalculate() const;
+
+  // Вызывается ячейкой перед тем, как её значение может измениться
+  void NoteValueChange(const Cell& cell);
+
+  // Память таблицы по подсистемам. Счётчики ведутся при каждом изменении,
+  // поэтому запрос ничего не обходит.
+  MemoryStats GetMemoryStats() const;
+  // Пул длинных текстов ячеек таблицы
+  StringPool& GetStringPool();
+  // Вызываются ячейками, когда их содержимое занимает или освобождает память
+  void AddMemoryUsage(const MemoryStats& usage);
+  void RemoveMemoryUsage(const MemoryStats& usage);
+
  private:
-  enum class PrintType { VALUES, TEXT };
+  enum class PrintType { VALUES, TEXT, LAST_VALUES };
   void PrintData(std::ostream& output, PrintType print_type) const;
-  
+
+  // Видимое значение ячейки; nullopt для пустой ячейки
+  using VisibleValue = std::optional<CellInterface::Value>;
+  struct PreviousValue {
+    bool known = false;
+    VisibleValue value;
+  };
+  VisibleValue GetVisibleValue(const Cell* cell) const;
+  std::shared_ptr<const SheetSnapshot::CellView> MakeCellView(
+      const Cell* cell) const;
+  std::shared_ptr<const SheetSnapshot> BuildSnapshot(bool settled_only);
+
+  Cell* FindCell(Position pos) const;
+  Cell* CreateCell(Position pos);
+  const CellInterface* GetPrintableCell(Position pos) const;
+  std::optional<CellInterface::Value> GetLastValue(Position pos) const;
+  Cell* Materialize(Position pos, const CellInterface& base_cell);
+  void MaterializeDependents(Position pos);
+  // Переносит в копию все ячейки родительского снимка и отвязывает его
+  void DetachBase();
+
+  enum class Axis { ROWS, COLUMNS };
+  // Сдвигает ячейки с координатой first и дальше по оси axis на delta:
+  // вставка при delta > 0, удаление -delta строк или столбцов при delta < 0
+  void ShiftCells(Axis axis, int first, int delta);
 
  private:
+  // Объявлены до data_: ячейки списывают свою память при уничтожении
+  MemoryStats memory_stats_;
+  StringPool string_pool_;
+  SharedSubexpressions shared_subexpressions_;
+  std::unique_ptr<ValueCache> value_cache_;
   std::vector<std::vector<std::unique_ptr<Cell>>> data_;
   Size print_size_ = {-1, -1};
+  bool deferred_parsing_ = false;
+  bool share_subexpressions_ = false;
+  ChangeJournal* journal_ = nullptr;
+  WorkloadRecorder* recorder_ = nullptr;
+  std::unique_ptr<SheetProfile> profile_;
+  bool track_changes_ = false;
+  bool eager_recalculation_ = false;
+  std::map<PositionKey, PreviousValue> pending_changes_;
+  uint64_t version_ = 0;
+  std::shared_ptr<const SheetSnapshot> snapshot_;
+  std::set<PositionKey> snapshot_dirty_cells_;
+  // Строки и столбцы сдвинуты: следующий снимок строится заново целиком
+  bool snapshot_layout_changed_ = false;
+  // Снимок родительской таблицы, если это копия из Fork()
+  std::shared_ptr<const SheetSnapshot> base_;
+  std::unordered_map<PositionKey, std::set<Cell*>, PositionKeyHasher>
+      base_references_;
+  // Формулы, ссылающиеся на ячейки, которых нет: пустые ячейки не
+  // создаются, и ссылка на далёкую ячейку не растит data_
+  std::unordered_map<PositionKey, std::set<Cell*>, PositionKeyHasher>
+      empty_references_;
+  Workbook* workbook_ = nullptr;
   void ResizeDataUpToPos(const Position& pos);
 };
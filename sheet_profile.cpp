@@ -0,0 +1,154 @@
+#include "sheet_profile.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <unordered_map>
+
+namespace {
+template <typename Key>
+std::vector<SheetProfile::Entry> GetTop(
+    const std::map<Position, SheetProfile::CellProfile>& cells, size_t top_n,
+    Key key) {
+  std::vector<SheetProfile::Entry> entries;
+  for (const auto& entry : cells) {
+    if (key(entry.second) > decltype(key(entry.second)){}) {
+      entries.push_back(entry);
+    }
+  }
+  size_t count = std::min(top_n, entries.size());
+  std::partial_sort(entries.begin(), entries.begin() + count, entries.end(),
+                    [&key](const auto& lhs, const auto& rhs) {
+                      return key(lhs.second) > key(rhs.second);
+                    });
+  entries.resize(count);
+  return entries;
+}
+
+std::string GetCellText(const SheetInterface& sheet, Position pos) {
+  const CellInterface* cell = sheet.GetCell(pos);
+  return cell ? cell->GetText() : std::string();
+}
+}  // namespace
+
+double SheetProfile::CellProfile::GetCacheHitRatio() const {
+  size_t reads = cache_hits + evaluations;
+  return reads == 0 ? 0.0 : static_cast<double>(cache_hits) / reads;
+}
+
+double SheetProfile::FormulaProfile::GetCacheHitRatio() const {
+  size_t reads = cache_hits + evaluations;
+  return reads == 0 ? 0.0 : static_cast<double>(cache_hits) / reads;
+}
+
+void SheetProfile::RecordEvaluation(Position pos,
+                                    std::chrono::nanoseconds duration) {
+  CellProfile& cell = cells_[pos];
+  ++cell.evaluations;
+  cell.evaluation_time += duration;
+}
+
+void SheetProfile::RecordCacheHit(Position pos) { ++cells_[pos].cache_hits; }
+
+void SheetProfile::RecordInvalidation(Position pos, size_t fanout) {
+  CellProfile& cell = cells_[pos];
+  ++cell.invalidations;
+  cell.invalidation_fanout += fanout;
+}
+
+void SheetProfile::RecordParse(Position pos,
+                               std::chrono::nanoseconds duration) {
+  CellProfile& cell = cells_[pos];
+  ++cell.parses;
+  cell.parse_time += duration;
+}
+
+const std::map<Position, SheetProfile::CellProfile>& SheetProfile::GetCells()
+    const {
+  return cells_;
+}
+
+void SheetProfile::RewritePositions(
+    const std::function<Position(Position)>& rewrite) {
+  std::map<Position, CellProfile> moved;
+  for (auto& [pos, cell] : cells_) {
+    if (Position target = rewrite(pos); target.IsValid()) {
+      moved.emplace(target, cell);
+    }
+  }
+  cells_ = std::move(moved);
+}
+
+std::vector<SheetProfile::Entry> SheetProfile::GetTopByEvaluationTime(
+    size_t top_n) const {
+  return GetTop(cells_, top_n,
+                [](const CellProfile& cell) { return cell.evaluation_time; });
+}
+
+std::vector<SheetProfile::Entry> SheetProfile::GetTopByInvalidationFanout(
+    size_t top_n) const {
+  return GetTop(cells_, top_n, [](const CellProfile& cell) {
+    return cell.invalidation_fanout;
+  });
+}
+
+std::vector<SheetProfile::FormulaProfile>
+SheetProfile::GetTopFormulasByEvaluationTime(const SheetInterface& sheet,
+                                             size_t top_n) const {
+  std::vector<FormulaProfile> formulas;
+  std::unordered_map<std::string, size_t> indices;
+  for (const auto& [pos, cell] : cells_) {
+    if (cell.evaluations == 0 && cell.cache_hits == 0) {
+      continue;
+    }
+    std::string text = GetCellText(sheet, pos);
+    if (text.empty() || text.front() != FORMULA_SIGN) {
+      continue;
+    }
+    auto [it, inserted] = indices.try_emplace(text, formulas.size());
+    if (inserted) {
+      formulas.push_back({std::move(text)});
+    }
+    FormulaProfile& formula = formulas[it->second];
+    ++formula.cells;
+    formula.evaluations += cell.evaluations;
+    formula.evaluation_time += cell.evaluation_time;
+    formula.cache_hits += cell.cache_hits;
+  }
+  size_t count = std::min(top_n, formulas.size());
+  std::partial_sort(formulas.begin(), formulas.begin() + count, formulas.end(),
+                    [](const FormulaProfile& lhs, const FormulaProfile& rhs) {
+                      return lhs.evaluation_time > rhs.evaluation_time;
+                    });
+  formulas.resize(count);
+  return formulas;
+}
+
+void SheetProfile::PrintReport(std::ostream& output,
+                               const SheetInterface& sheet,
+                               size_t top_n) const {
+  output << std::fixed << std::setprecision(1);
+  output << "Hot cells by evaluation time:\n";
+  for (const auto& [pos, cell] : GetTopByEvaluationTime(top_n)) {
+    output << "  " << std::left << std::setw(8) << pos.ToString() << std::right
+           << std::setw(12) << cell.evaluation_time.count() / 1e3 << "us"
+           << std::setw(8) << cell.evaluations << " evals"
+           << std::setw(7) << cell.GetCacheHitRatio() * 100 << "% hits  "
+           << GetCellText(sheet, pos) << '\n';
+  }
+  output << "Hot cells by invalidation fan-out:\n";
+  for (const auto& [pos, cell] : GetTopByInvalidationFanout(top_n)) {
+    output << "  " << std::left << std::setw(8) << pos.ToString() << std::right
+           << std::setw(10) << cell.invalidation_fanout << " dependents"
+           << std::setw(8) << cell.invalidations << " edits  "
+           << GetCellText(sheet, pos) << '\n';
+  }
+  output << "Hot formulas by evaluation time:\n";
+  for (const FormulaProfile& formula :
+       GetTopFormulasByEvaluationTime(sheet, top_n)) {
+    output << "  " << std::setw(6) << formula.cells << " cells"
+           << std::setw(12) << formula.evaluation_time.count() / 1e3 << "us"
+           << std::setw(8) << formula.evaluations << " evals"
+           << std::setw(7) << formula.GetCacheHitRatio() * 100 << "% hits  "
+           << formula.text << '\n';
+  }
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "common.h"
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Профиль пересчёта таблицы: сколько стоила каждая ячейка. Собирается, пока
+// таблица в режиме профилирования (Sheet::SetProfiling); без него таблица
+// только проверяет, что профиль не подключён.
+class SheetProfile {
+ public:
+  struct CellProfile {
+    // Вычисления формулы и их суммарное время. Аргументы формулы к началу
+    // вычисления уже в кэше, поэтому время - собственное время ячейки.
+    size_t evaluations = 0;
+    std::chrono::nanoseconds evaluation_time{0};
+    // Чтения значения формулы, обслуженные из кэша
+    size_t cache_hits = 0;
+    // Правки ячейки и число зависимых ячеек, кэш которых они сбросили
+    size_t invalidations = 0;
+    size_t invalidation_fanout = 0;
+    size_t parses = 0;
+    std::chrono::nanoseconds parse_time{0};
+
+    // Доля чтений из кэша среди всех чтений значения формулы
+    double GetCacheHitRatio() const;
+  };
+
+  using Entry = std::pair<Position, CellProfile>;
+
+  // Замеры ячеек с одинаковым текстом формулы, сложенные вместе: формула,
+  // размноженная по многим ячейкам, видна одной строкой
+  struct FormulaProfile {
+    std::string text;
+    size_t cells = 0;
+    size_t evaluations = 0;
+    std::chrono::nanoseconds evaluation_time{0};
+    size_t cache_hits = 0;
+
+    double GetCacheHitRatio() const;
+  };
+
+  void RecordEvaluation(Position pos, std::chrono::nanoseconds duration);
+  void RecordCacheHit(Position pos);
+  void RecordInvalidation(Position pos, size_t fanout);
+  void RecordParse(Position pos, std::chrono::nanoseconds duration);
+
+  const std::map<Position, CellProfile>& GetCells() const;
+
+  // Переносит замеры сдвинутых ячеек на новые позиции. Замеры ячеек, для
+  // которых rewrite вернул некорректную позицию, удаляются.
+  void RewritePositions(const std::function<Position(Position)>& rewrite);
+
+  // Не больше top_n ячеек по убыванию суммарного времени вычисления и
+  // по убыванию числа сброшенных правками зависимых
+  std::vector<Entry> GetTopByEvaluationTime(size_t top_n) const;
+  std::vector<Entry> GetTopByInvalidationFanout(size_t top_n) const;
+  // Не больше top_n формул по убыванию суммарного времени вычисления всех
+  // ячеек с этим текстом; тексты берутся из sheet
+  std::vector<FormulaProfile> GetTopFormulasByEvaluationTime(
+      const SheetInterface& sheet, size_t top_n) const;
+
+  // Печатает таблицы лидеров по ячейкам и по формулам с текстами из sheet
+  void PrintReport(std::ostream& output, const SheetInterface& sheet,
+                   size_t top_n = 10) const;
+
+ private:
+  std::map<Position, CellProfile> cells_;
+};
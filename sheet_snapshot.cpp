@@ -0,0 +1,105 @@
+#include "sheet_snapshot.h"
+
+#include "formula.h"
+
+#include <iostream>
+
+SheetSnapshot::CellView::CellView(std::string text, Value value,
+                                  std::vector<Position> references)
+    : text_(std::move(text)),
+      value_(std::move(value)),
+      referenced_cells_(std::move(references)) {}
+
+CellInterface::Value SheetSnapshot::CellView::GetValue() const {
+  return value_;
+}
+
+std::string SheetSnapshot::CellView::GetText() const { return text_; }
+
+std::vector<Position> SheetSnapshot::CellView::GetReferencedCells() const {
+  return referenced_cells_;
+}
+
+SheetSnapshot::SheetSnapshot(Rows rows, Size printable_size, uint64_t version,
+                             bool complete)
+    : rows_(std::move(rows)),
+      printable_size_(printable_size),
+      version_(version),
+      complete_(complete) {}
+
+const CellInterface* SheetSnapshot::GetCell(Position pos) const {
+  if (!pos.IsValid()) {
+    throw InvalidPositionException("Invalid position");
+  }
+  if (pos.row < static_cast<int>(rows_.size()) && rows_[pos.row]) {
+    const Row& row = *rows_[pos.row];
+    if (pos.col < static_cast<int>(row.size())) {
+      return row[pos.col].get();
+    }
+  }
+  return nullptr;
+}
+
+Size SheetSnapshot::GetPrintableSize() const { return printable_size_; }
+
+uint64_t SheetSnapshot::GetVersion() const { return version_; }
+
+bool SheetSnapshot::IsComplete() const { return complete_; }
+
+const SheetSnapshot::Rows& SheetSnapshot::GetRows() const { return rows_; }
+
+const std::vector<Position>& SheetSnapshot::GetDependentCells(
+    Position pos) const {
+  static const std::vector<Position> NO_DEPENDENTS;
+  std::call_once(dependents_once_, [this] { BuildDependentsIndex(); });
+  auto it = dependents_.find(pos);
+  return it == dependents_.end() ? NO_DEPENDENTS : it->second;
+}
+
+void SheetSnapshot::BuildDependentsIndex() const {
+  for (int row_idx = 0; row_idx < static_cast<int>(rows_.size()); ++row_idx) {
+    if (!rows_[row_idx]) {
+      continue;
+    }
+    const Row& row = *rows_[row_idx];
+    for (int col_idx = 0; col_idx < static_cast<int>(row.size()); ++col_idx) {
+      if (!row[col_idx]) {
+        continue;
+      }
+      for (Position ref : row[col_idx]->GetReferencedCells()) {
+        dependents_[ref].push_back({row_idx, col_idx});
+      }
+    }
+  }
+}
+
+void SheetSnapshot::PrintData(std::ostream& output,
+                              PrintType print_type) const {
+  for (int row_idx = 0; row_idx < printable_size_.rows; ++row_idx) {
+    for (int col_idx = 0; col_idx < printable_size_.cols; ++col_idx) {
+      if (col_idx != 0) {
+        output << '\t';
+      }
+      const CellInterface* cell = GetCell({row_idx, col_idx});
+      if (cell) {
+        switch (print_type) {
+          case PrintType::VALUES:
+            output << cell->GetValue();
+            break;
+          case PrintType::TEXT:
+            output << cell->GetText();
+            break;
+        }
+      }
+    }
+    output << '\n';
+  }
+}
+
+void SheetSnapshot::PrintValues(std::ostream& output) const {
+  PrintData(output, PrintType::VALUES);
+}
+
+void SheetSnapshot::PrintTexts(std::ostream& output) const {
+  PrintData(output, PrintType::TEXT);
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "common.h"
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Неизменяемый снимок таблицы: тексты и уже вычисленные значения ячеек на
+// момент Sheet::Snapshot(). Снимок не меняется после создания, поэтому его
+// можно читать из любого числа потоков одновременно с редактированием
+// таблицы. Соседние версии разделяют неизменившиеся строки и ячейки; память
+// старой версии освобождается, когда отпускается последняя ссылка на неё.
+class SheetSnapshot {
+ public:
+  class CellView final : public CellInterface {
+   public:
+    CellView(std::string text, Value value, std::vector<Position> references);
+
+    Value GetValue() const override;
+    std::string GetText() const override;
+    std::vector<Position> GetReferencedCells() const override;
+
+   private:
+    std::string text_;
+    Value value_;
+    std::vector<Position> referenced_cells_;
+  };
+
+  using Row = std::vector<std::shared_ptr<const CellView>>;
+  using Rows = std::vector<std::shared_ptr<const Row>>;
+
+  SheetSnapshot(Rows rows, Size printable_size, uint64_t version,
+                bool complete = true);
+
+  // Возвращает ячейку снимка или nullptr, если она пуста
+  const CellInterface* GetCell(Position pos) const;
+  Size GetPrintableSize() const;
+  // Номер правки таблицы, которой соответствует снимок
+  uint64_t GetVersion() const;
+  // false, если значения части ячеек взяты из более ранней версии
+  bool IsComplete() const;
+
+  void PrintValues(std::ostream& output) const;
+  void PrintTexts(std::ostream& output) const;
+
+  const Rows& GetRows() const;
+
+  // Ячейки, формулы которых непосредственно ссылаются на pos. Обратный
+  // индекс строится при первом обращении и разделяется всеми копиями
+  // таблицы, созданными из этого снимка.
+  const std::vector<Position>& GetDependentCells(Position pos) const;
+
+ private:
+  enum class PrintType { VALUES, TEXT };
+  void PrintData(std::ostream& output, PrintType print_type) const;
+
+  void BuildDependentsIndex() const;
+
+  Rows rows_;
+  Size printable_size_;
+  uint64_t version_ = 0;
+  bool complete_ = true;
+
+  mutable std::once_flag dependents_once_;
+  mutable std::map<Position, std::vector<Position>> dependents_;
+};
@@ -0,0 +1,56 @@
+#include "string_pool.h"
+
+#include <utility>
+
+StringPool::Ref::Ref(Entry* entry) : entry_(entry) { ++entry_->refs; }
+
+StringPool::Ref::Ref(const Ref& other) : entry_(other.entry_) {
+  if (entry_) {
+    ++entry_->refs;
+  }
+}
+
+StringPool::Ref::Ref(Ref&& other) noexcept
+    : entry_(std::exchange(other.entry_, nullptr)) {}
+
+StringPool::Ref& StringPool::Ref::operator=(Ref other) noexcept {
+  std::swap(entry_, other.entry_);
+  return *this;
+}
+
+StringPool::Ref::~Ref() {
+  if (entry_ && --entry_->refs == 0) {
+    entry_->pool->Release(entry_);
+  }
+}
+
+const std::string& StringPool::Ref::Get() const { return entry_->text; }
+
+StringPool::Ref StringPool::Intern(std::string_view text) {
+  if (auto it = entries_.find(text); it != entries_.end()) {
+    return Ref(it->second.get());
+  }
+  auto entry = std::make_unique<Entry>();
+  entry->text = std::string(text);
+  entry->pool = this;
+  Entry* result = entry.get();
+  usage_ += {GetEntryBytes(*result), 1};
+  entries_.emplace(result->text, std::move(entry));
+  return Ref(result);
+}
+
+size_t StringPool::GetSize() const { return entries_.size(); }
+
+MemoryStats::Usage StringPool::GetUsage() const { return usage_; }
+
+void StringPool::Release(Entry* entry) {
+  usage_ -= {GetEntryBytes(*entry), 1};
+  entries_.erase(entries_.find(entry->text));
+}
+
+size_t StringPool::GetEntryBytes(const Entry& entry) {
+  // Запись, её строка и узел хэш-таблицы с указателем в массиве корзин
+  return sizeof(Entry) + entry.text.capacity() + 1 +
+         sizeof(std::pair<const std::string_view, std::unique_ptr<Entry>>) +
+         2 * sizeof(void*);
+}
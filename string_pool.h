@@ -0,0 +1,59 @@
+#pragma once
+
+#include "memory_stats.h"
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Пул текстов таблицы: одинаковые тексты ячеек хранятся один раз. Строка
+// живёт, пока на неё есть ссылки, и удаляется из пула вместе с последней.
+// Пул не потокобезопасен: ссылки создаются и уничтожаются при правке таблицы.
+class StringPool {
+ private:
+  struct Entry;
+
+ public:
+  // Ссылка на строку пула; копирование увеличивает счётчик ссылок
+  class Ref {
+   public:
+    Ref() = default;
+    Ref(const Ref& other);
+    Ref(Ref&& other) noexcept;
+    Ref& operator=(Ref other) noexcept;
+    ~Ref();
+
+    const std::string& Get() const;
+
+   private:
+    friend class StringPool;
+    explicit Ref(Entry* entry);
+
+    Entry* entry_ = nullptr;
+  };
+
+  StringPool() = default;
+  StringPool(const StringPool&) = delete;
+  StringPool& operator=(const StringPool&) = delete;
+
+  Ref Intern(std::string_view text);
+  // Число строк в пуле
+  size_t GetSize() const;
+  // Память строк пула; count - число строк
+  MemoryStats::Usage GetUsage() const;
+
+ private:
+  struct Entry {
+    std::string text;
+    size_t refs = 0;
+    StringPool* pool = nullptr;
+  };
+
+  void Release(Entry* entry);
+  static size_t GetEntryBytes(const Entry& entry);
+
+  // Ключ указывает на текст записи, который не меняется, пока она в пуле
+  std::unordered_map<std::string_view, std::unique_ptr<Entry>> entries_;
+  MemoryStats::Usage usage_;
+};
@@ -1,8 +1,8 @@
 #include "common.h"
 
-#include <cctype>
-#include <sstream>
+#include <charconv>
 #include <algorithm>
+#include <tuple>
 
 const int LETTERS = 26;
 const int MAX_POSITION_LENGTH = 17;
@@ -10,14 +10,6 @@ const int MAX_POS_LETTER_COUNT = 3;
 
 const Position Position::NONE = {-1, -1};
 
-bool Position::operator==(const Position rhs) const {
-    return row == rhs.row && col == rhs.col;
-}
-
-bool Position::operator<(const Position rhs) const {
-    return std::tie(row, col) < std::tie(rhs.row, rhs.col);
-}
-
 bool Position::IsValid() const {
     return row >= 0 && col >= 0 && row < MAX_ROWS && col < MAX_COLS;
 }
@@ -27,52 +19,85 @@ std::string Position::ToString() const {
         return "";
     }
 
-    std::string result;
-    result.reserve(MAX_POSITION_LENGTH);
-    int c = col;
-    while (c >= 0) {
-        result.insert(result.begin(), 'A' + c % LETTERS);
-        c = c / LETTERS - 1;
+    // Буквы столбца пишутся с конца буфера, номер строки - следом за ними
+    char buffer[MAX_POSITION_LENGTH];
+    char* letters = buffer + MAX_POS_LETTER_COUNT;
+    for (int c = col; c >= 0; c = c / LETTERS - 1) {
+        *--letters = static_cast<char>('A' + c % LETTERS);
     }
-
-    result += std::to_string(row + 1);
-
-    return result;
+    char* end = std::to_chars(buffer + MAX_POS_LETTER_COUNT,
+                              buffer + MAX_POSITION_LENGTH, row + 1).ptr;
+    return std::string(letters, end);
 }
 
 Position Position::FromString(std::string_view str) {
-    auto it = std::find_if(str.begin(), str.end(), [](const char c) {
-        return !(std::isalpha(c) && std::isupper(c));
-    });
-    auto letters = str.substr(0, it - str.begin());
-    auto digits = str.substr(it - str.begin());
-
-    if (letters.empty() || digits.empty()) {
-        return Position::NONE;
+    // Не isupper: тот зависит от локали
+    size_t letter_count = 0;
+    while (letter_count < str.size() && letter_count <= MAX_POS_LETTER_COUNT &&
+           str[letter_count] >= 'A' && str[letter_count] <= 'Z') {
+        ++letter_count;
     }
-    if (letters.size() > MAX_POS_LETTER_COUNT) {
+    if (letter_count == 0 || letter_count > MAX_POS_LETTER_COUNT ||
+        letter_count == str.size()) {
         return Position::NONE;
     }
 
-    if (!std::isdigit(digits[0])) {
+    // Минус from_chars принял бы, поэтому первая цифра проверяется отдельно.
+    // При переполнении from_chars возвращает ошибку.
+    const char* digits = str.data() + letter_count;
+    const char* end = str.data() + str.size();
+    if (*digits < '0' || *digits > '9') {
         return Position::NONE;
     }
-
-    int row;
-    std::istringstream row_in{std::string{digits}};
-    if (!(row_in >> row) || !row_in.eof()) {
+    int row = 0;
+    auto [ptr, ec] = std::from_chars(digits, end, row);
+    if (ec != std::errc() || ptr != end) {
         return Position::NONE;
     }
 
     int col = 0;
-    for (char ch : letters) {
-        col *= LETTERS;
-        col += ch - 'A' + 1;
+    for (size_t i = 0; i < letter_count; ++i) {
+        col = col * LETTERS + (str[i] - 'A' + 1);
     }
 
     return {row - 1, col - 1};
 }
 
+uint32_t PositionKey::GetMortonCode() const {
+    // Раздвигает 16 бит так, что между соседними появляется нулевой бит
+    auto spread = [](uint32_t x) {
+        x = (x | (x << 8)) & 0x00FF00FF;
+        x = (x | (x << 4)) & 0x0F0F0F0F;
+        x = (x | (x << 2)) & 0x33333333;
+        x = (x | (x << 1)) & 0x55555555;
+        return x;
+    };
+    return spread(value_ >> COL_BITS) << 1 | spread(value_ & COL_MASK);
+}
+
+bool SheetPosition::operator==(const SheetPosition& rhs) const {
+    return sheet == rhs.sheet && pos == rhs.pos;
+}
+
+bool SheetPosition::operator<(const SheetPosition& rhs) const {
+    return std::tie(sheet, pos) < std::tie(rhs.sheet, rhs.pos);
+}
+
+std::string SheetPosition::ToString() const {
+    return sheet + '!' + pos.ToString();
+}
+
+bool SheetPosition::IsValidSheetName(std::string_view name) {
+    // Явные диапазоны ASCII, как в грамматике: std::isalnum зависит от локали
+    auto is_digit = [](char c) { return c >= '0' && c <= '9'; };
+    auto is_name_char = [&](char c) {
+        return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || is_digit(c) ||
+               c == '_';
+    };
+    return !name.empty() && !is_digit(name[0]) &&
+           std::all_of(name.begin(), name.end(), is_name_char);
+}
+
 bool Size::operator==(Size rhs) const {
     return cols == rhs.cols && rows == rhs.rows;
 }
\ No newline at end of file
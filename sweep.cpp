@@ -0,0 +1,268 @@
+#include "sweep.h"
+
+#include <algorithm>
+#include <future>
+#include <set>
+#include <stdexcept>
+#include <thread>
+
+namespace {
+class SlotCell final : public CellInterface {
+ public:
+  Value GetValue() const override { return value_; }
+  std::string GetText() const override { return {}; }
+  std::vector<Position> GetReferencedCells() const override { return {}; }
+
+  void SetValue(Value value) { value_ = std::move(value); }
+
+ private:
+  Value value_ = 0.0;
+};
+
+CellInterface::Value ToCellValue(const FormulaInterface::Value& value) {
+  if (std::holds_alternative<double>(value)) {
+    return std::get<double>(value);
+  }
+  return std::get<FormulaError>(value);
+}
+
+using SheetCell = std::pair<const SheetInterface*, Position>;
+
+// Ссылки на другие листы книги из формулы cell листа owner
+std::vector<SheetCell> GetSheetReferences(const SheetInterface& owner,
+                                          const CellInterface& cell) {
+  std::vector<SheetCell> result;
+  std::string text = cell.GetText();
+  if (text.size() <= 1 || text.front() != FORMULA_SIGN) {
+    return result;
+  }
+  for (const SheetPosition& ref : ScanSheetReferences(text.substr(1))) {
+    // Ссылка на отсутствующий лист вычисляется в #REF! и никуда не ведёт
+    if (const SheetInterface* target = owner.FindSheet(ref.sheet)) {
+      result.emplace_back(target, ref.pos);
+    }
+  }
+  return result;
+}
+
+// Доходят ли ссылки из start, в том числе через другие листы книги, до
+// входов inputs листа sheet. visited общий для всех вызовов: из ячеек,
+// пройденных без результата, входы недостижимы.
+bool ReachesInputs(const SheetInterface& sheet,
+                   const std::set<Position>& inputs,
+                   std::vector<SheetCell> start, std::set<SheetCell>& visited) {
+  std::vector<SheetCell> worklist = std::move(start);
+  while (!worklist.empty()) {
+    auto [owner, pos] = worklist.back();
+    worklist.pop_back();
+    if (!visited.insert({owner, pos}).second) {
+      continue;
+    }
+    if (owner == &sheet && inputs.count(pos)) {
+      return true;
+    }
+    const CellInterface* cell = owner->GetCell(pos);
+    if (cell == nullptr) {
+      continue;
+    }
+    for (Position ref : cell->GetReferencedCells()) {
+      worklist.emplace_back(owner, ref);
+    }
+    for (const SheetCell& ref : GetSheetReferences(*owner, *cell)) {
+      worklist.push_back(ref);
+    }
+  }
+  return false;
+}
+}  // namespace
+
+// Значения ячеек для одного набора входов. Формулы программы вычисляются
+// относительно кадра, а не исходной таблицы, поэтому у каждого потока он свой.
+class ParameterSweep::Frame final : public SheetInterface {
+ public:
+  explicit Frame(const ParameterSweep& sweep) : sweep_(sweep) {
+    cells_.resize(sweep.constants_.size());
+    for (size_t slot = 0; slot < cells_.size(); ++slot) {
+      cells_[slot].SetValue(sweep.constants_[slot]);
+    }
+  }
+
+  void SetValue(size_t slot, Value value) {
+    cells_[slot].SetValue(std::move(value));
+  }
+
+  Value GetValue(size_t slot) const { return cells_[slot].GetValue(); }
+
+  const CellInterface* GetCell(Position pos) const override {
+    auto it = sweep_.slots_.find(pos);
+    return it == sweep_.slots_.end() ? nullptr : &cells_[it->second];
+  }
+
+  CellInterface* GetCell(Position pos) override {
+    auto it = sweep_.slots_.find(pos);
+    return it == sweep_.slots_.end() ? nullptr : &cells_[it->second];
+  }
+
+  void SetCell(Position, std::string) override {
+    throw std::logic_error("Sweep frame is read-only");
+  }
+
+  void ClearCell(Position) override {
+    throw std::logic_error("Sweep frame is read-only");
+  }
+
+  Size GetPrintableSize() const override { return {0, 0}; }
+  void PrintValues(std::ostream&) const override {}
+  void PrintTexts(std::ostream&) const override {}
+
+ private:
+  const ParameterSweep& sweep_;
+  std::vector<SlotCell> cells_;
+};
+
+ParameterSweep::ParameterSweep(const SheetInterface& sheet,
+                               std::vector<Position> inputs,
+                               std::vector<Position> outputs) {
+  auto is_invalid = [](Position pos) { return !pos.IsValid(); };
+  if (std::any_of(inputs.begin(), inputs.end(), is_invalid) ||
+      std::any_of(outputs.begin(), outputs.end(), is_invalid)) {
+    throw InvalidPositionException("Invalid position");
+  }
+
+  auto get_slot = [this](Position pos) {
+    auto [it, inserted] = slots_.emplace(pos, constants_.size());
+    if (inserted) {
+      constants_.emplace_back(0.0);
+    }
+    return it->second;
+  };
+
+  std::set<Position> input_set(inputs.begin(), inputs.end());
+  for (Position pos : inputs) {
+    input_slots_.push_back(get_slot(pos));
+  }
+
+  // Ячейки, от которых зависят выходы, в порядке выхода из обхода в глубину:
+  // каждая идёт после своих аргументов. Входы не раскрываются.
+  std::set<Position> visited;
+  std::vector<Position> order;
+  std::vector<std::pair<Position, bool>> stack;
+  for (auto it = outputs.rbegin(); it != outputs.rend(); ++it) {
+    stack.emplace_back(*it, false);
+  }
+  while (!stack.empty()) {
+    auto [pos, expanded] = stack.back();
+    stack.pop_back();
+    if (expanded) {
+      order.push_back(pos);
+      continue;
+    }
+    if (!visited.insert(pos).second) {
+      continue;
+    }
+    stack.emplace_back(pos, true);
+    const CellInterface* cell = sheet.GetCell(pos);
+    if (input_set.count(pos) || cell == nullptr) {
+      continue;
+    }
+    for (Position ref : cell->GetReferencedCells()) {
+      if (!visited.count(ref)) {
+        stack.emplace_back(ref, false);
+      }
+    }
+  }
+
+  // Формулы, зависящие от входов, попадают в программу, остальные ячейки
+  // вычисляются один раз. Формула, которая доходит до входа только через
+  // другой лист, тоже зависит от входов, и замороженное значение было бы
+  // неверным.
+  std::set<Position> affected = input_set;
+  std::set<SheetCell> cross_sheet_visited;
+  for (Position pos : order) {
+    if (input_set.count(pos)) {
+      continue;
+    }
+    const CellInterface* cell = sheet.GetCell(pos);
+    if (cell == nullptr) {
+      continue;
+    }
+    auto refs = cell->GetReferencedCells();
+    bool depends_on_inputs =
+        std::any_of(refs.begin(), refs.end(),
+                    [&affected](Position ref) { return affected.count(ref); });
+    size_t slot = get_slot(pos);
+    if (depends_on_inputs) {
+      affected.insert(pos);
+      auto formula = ParseFormula(cell->GetText().substr(1));
+      if (!formula->GetSheetReferences().empty()) {
+        throw std::invalid_argument(
+            "Cross-sheet references are not supported in a sweep: " +
+            pos.ToString());
+      }
+      program_.push_back({slot, std::move(formula)});
+    } else {
+      if (ReachesInputs(sheet, input_set, GetSheetReferences(sheet, *cell),
+                        cross_sheet_visited)) {
+        throw std::invalid_argument(
+            "Cross-sheet reference leads back to a sweep input: " +
+            pos.ToString());
+      }
+      constants_[slot] = cell->GetValue();
+    }
+  }
+
+  for (Position pos : outputs) {
+    output_slots_.push_back(get_slot(pos));
+  }
+}
+
+size_t ParameterSweep::GetProgramSize() const { return program_.size(); }
+
+void ParameterSweep::EvaluateRow(Frame& frame,
+                                 const std::vector<double>& inputs,
+                                 std::vector<Value>& outputs) const {
+  for (size_t i = 0; i < input_slots_.size(); ++i) {
+    frame.SetValue(input_slots_[i], inputs[i]);
+  }
+  for (const Step& step : program_) {
+    frame.SetValue(step.slot, ToCellValue(step.formula->Evaluate(frame)));
+  }
+  outputs.clear();
+  for (size_t slot : output_slots_) {
+    outputs.push_back(frame.GetValue(slot));
+  }
+}
+
+std::vector<std::vector<ParameterSweep::Value>> ParameterSweep::Run(
+    const std::vector<std::vector<double>>& input_rows, size_t threads) const {
+  for (const auto& row : input_rows) {
+    if (row.size() != input_slots_.size()) {
+      throw std::invalid_argument("Input row size mismatch");
+    }
+  }
+
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  threads = std::max<size_t>(1, std::min(threads, input_rows.size()));
+
+  std::vector<std::vector<Value>> results(input_rows.size());
+  auto evaluate_range = [&](size_t begin, size_t end) {
+    Frame frame(*this);
+    for (size_t row = begin; row < end; ++row) {
+      EvaluateRow(frame, input_rows[row], results[row]);
+    }
+  };
+
+  std::vector<std::future<void>> workers;
+  size_t chunk = (input_rows.size() + threads - 1) / threads;
+  for (size_t begin = chunk; begin < input_rows.size(); begin += chunk) {
+    workers.push_back(std::async(std::launch::async, evaluate_range, begin,
+                                 std::min(begin + chunk, input_rows.size())));
+  }
+  evaluate_range(0, std::min(chunk, input_rows.size()));
+  for (auto& worker : workers) {
+    worker.get();
+  }
+  return results;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "common.h"
+#include "formula.h"
+
+#include <map>
+#include <memory>
+#include <vector>
+
+// Перебор параметров: вычисляет выходные ячейки таблицы для множества наборов
+// значений входных ячеек, не изменяя саму таблицу.
+//
+// Конструктор один раз выделяет ячейки, лежащие на путях от входов к выходам,
+// разбирает их формулы и выстраивает в порядке вычисления. Значения остальных
+// ячеек, от которых зависят выходы, вычисляются сразу и дальше считаются
+// константами. После этого Run() не обращается к таблице и обрабатывает
+// наборы входов параллельно; таблица при этом может свободно изменяться.
+class ParameterSweep {
+ public:
+  using Value = CellInterface::Value;
+
+  // Бросает InvalidPositionException для некорректной позиции и
+  // std::invalid_argument, если зависящая от входов формула ссылается на
+  // другой лист книги или если формула доходит до входа через другой лист
+  ParameterSweep(const SheetInterface& sheet, std::vector<Position> inputs,
+                 std::vector<Position> outputs);
+
+  // Возвращает по строке на каждый набор входов: значения выходов в порядке,
+  // заданном в конструкторе. Каждый набор должен содержать по значению на
+  // каждый вход, иначе бросается std::invalid_argument. threads == 0 -
+  // по числу аппаратных потоков.
+  std::vector<std::vector<Value>> Run(
+      const std::vector<std::vector<double>>& input_rows,
+      size_t threads = 0) const;
+
+  // Число формул, которые вычисляются для каждого набора входов
+  size_t GetProgramSize() const;
+
+ private:
+  struct Step {
+    size_t slot;
+    std::unique_ptr<FormulaInterface> formula;
+  };
+
+  class Frame;
+
+  void EvaluateRow(Frame& frame, const std::vector<double>& inputs,
+                   std::vector<Value>& outputs) const;
+
+  // Позиция ячейки -> номер её значения в кадре вычисления. Позиций, которых
+  // здесь нет, формулы не касаются либо они пусты.
+  std::map<Position, size_t> slots_;
+  std::vector<Value> constants_;
+  std::vector<size_t> input_slots_;
+  std::vector<size_t> output_slots_;
+  std::vector<Step> program_;
+};
@@ -0,0 +1,114 @@
+#include "tracing.h"
+
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+struct TraceEvent {
+  const char* name;
+  Clock::time_point start;
+  Clock::duration duration;
+};
+
+// Кольцевой буфер одного потока. Мьютекс захватывает только сам поток,
+// пока не печатается трасса, поэтому он почти всегда свободен.
+struct ThreadBuffer {
+  explicit ThreadBuffer(uint32_t id) : thread_id(id) {
+    events.reserve(Tracer::BUFFER_EVENTS);
+  }
+
+  std::mutex mutex;
+  uint32_t thread_id;
+  std::vector<TraceEvent> events;
+  size_t next = 0;
+};
+
+struct Registry {
+  std::mutex mutex;
+  std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+  uint32_t next_thread_id = 1;
+  Clock::time_point epoch = Clock::now();
+};
+
+Registry& GetRegistry() {
+  static Registry registry;
+  return registry;
+}
+
+ThreadBuffer& GetThreadBuffer() {
+  thread_local std::shared_ptr<ThreadBuffer> buffer = [] {
+    Registry& registry = GetRegistry();
+    std::lock_guard lock(registry.mutex);
+    auto buffer = std::make_shared<ThreadBuffer>(registry.next_thread_id++);
+    registry.buffers.push_back(buffer);
+    return buffer;
+  }();
+  return *buffer;
+}
+
+double ToMicroseconds(Clock::duration duration) {
+  return std::chrono::duration<double, std::micro>(duration).count();
+}
+}  // namespace
+
+void Tracer::Enable(bool enabled) {
+  GetRegistry();
+  enabled_.store(enabled, std::memory_order_relaxed);
+}
+
+void Tracer::Record(const char* name, Clock::time_point start,
+                    Clock::time_point end) {
+  ThreadBuffer& buffer = GetThreadBuffer();
+  std::lock_guard lock(buffer.mutex);
+  TraceEvent event{name, start, end - start};
+  if (buffer.events.size() < BUFFER_EVENTS) {
+    buffer.events.push_back(event);
+  } else {
+    buffer.events[buffer.next] = event;
+  }
+  buffer.next = (buffer.next + 1) % BUFFER_EVENTS;
+}
+
+void Tracer::Clear() {
+  Registry& registry = GetRegistry();
+  std::lock_guard lock(registry.mutex);
+  std::vector<std::shared_ptr<ThreadBuffer>> alive;
+  for (auto& buffer : registry.buffers) {
+    // Буфер завершившегося потока больше никто не пополнит
+    if (buffer.use_count() > 1) {
+      std::lock_guard buffer_lock(buffer->mutex);
+      buffer->events.clear();
+      buffer->next = 0;
+      alive.push_back(std::move(buffer));
+    }
+  }
+  registry.buffers = std::move(alive);
+}
+
+void Tracer::WriteChromeTrace(std::ostream& output) {
+  Registry& registry = GetRegistry();
+  std::lock_guard lock(registry.mutex);
+  output << std::fixed << std::setprecision(3);
+  output << "{\"traceEvents\": [";
+  bool first = true;
+  for (const auto& buffer : registry.buffers) {
+    std::lock_guard buffer_lock(buffer->mutex);
+    const auto& events = buffer->events;
+    // После заполнения самое старое событие лежит на месте следующей записи
+    size_t begin = events.size() < BUFFER_EVENTS ? 0 : buffer->next;
+    for (size_t i = 0; i < events.size(); ++i) {
+      const TraceEvent& event = events[(begin + i) % events.size()];
+      output << (first ? "\n" : ",\n") << "{\"name\": \"" << event.name
+             << "\", \"cat\": \"spreadsheet\", \"ph\": \"X\", \"ts\": "
+             << ToMicroseconds(event.start - registry.epoch)
+             << ", \"dur\": " << ToMicroseconds(event.duration)
+             << ", \"pid\": 1, \"tid\": " << buffer->thread_id << "}";
+      first = false;
+    }
+  }
+  output << "\n], \"displayTimeUnit\": \"ns\"}\n";
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+// Трассировка редактирования и пересчёта. Участки кода помечаются объектами
+// TraceSpan; пока трассировка включена, каждый участок оставляет событие с
+// временем начала и длительностью в кольцевом буфере своего потока. Буфер
+// хранит последние BUFFER_EVENTS событий. Выключенная трассировка стоит
+// одной атомарной проверки на участок.
+class Tracer {
+ public:
+  static constexpr size_t BUFFER_EVENTS = 1 << 16;
+
+  static void Enable(bool enabled);
+  static bool IsEnabled() {
+    return enabled_.load(std::memory_order_relaxed);
+  }
+
+  // Удаляет накопленные события всех потоков
+  static void Clear();
+
+  // Печатает события всех потоков в формате trace_event JSON, который
+  // открывают chrome://tracing и Perfetto
+  static void WriteChromeTrace(std::ostream& output);
+
+  // name должен жить до конца программы, обычно это строковый литерал
+  static void Record(const char* name,
+                     std::chrono::steady_clock::time_point start,
+                     std::chrono::steady_clock::time_point end);
+
+ private:
+  static inline std::atomic<bool> enabled_ = false;
+};
+
+class TraceSpan {
+ public:
+  explicit TraceSpan(const char* name)
+      : name_(Tracer::IsEnabled() ? name : nullptr) {
+    if (name_) {
+      start_ = std::chrono::steady_clock::now();
+    }
+  }
+  TraceSpan(const TraceSpan&) = delete;
+  TraceSpan& operator=(const TraceSpan&) = delete;
+  ~TraceSpan() {
+    if (name_) {
+      Tracer::Record(name_, start_, std::chrono::steady_clock::now());
+    }
+  }
+
+ private:
+  const char* name_;
+  std::chrono::steady_clock::time_point start_;
+};
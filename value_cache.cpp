@@ -0,0 +1,103 @@
+#include "value_cache.h"
+
+#include "cell.h"
+
+namespace {
+const size_t VALUE_BYTES = sizeof(CellInterface::Value);
+}  // namespace
+
+ValueCache::ValueCache(size_t budget_bytes) : budget_bytes_(budget_bytes) {}
+
+size_t ValueCache::GetBudget() const { return budget_bytes_; }
+
+void ValueCache::SetBudget(size_t budget_bytes) {
+  budget_bytes_ = budget_bytes;
+  EvictOverBudget(nullptr);
+}
+
+size_t ValueCache::GetUsedBytes() const { return slots_.size() * VALUE_BYTES; }
+
+size_t ValueCache::GetEvictionCount() const { return evictions_; }
+
+void ValueCache::SetPinned(Position pos, bool pinned) {
+  if (pinned) {
+    pinned_.insert(pos);
+  } else {
+    pinned_.erase(pos);
+  }
+}
+
+void ValueCache::RewritePinned(
+    const std::function<Position(Position)>& rewrite) {
+  std::set<Position> pinned;
+  for (Position pos : pinned_) {
+    if (Position rewritten = rewrite(pos); rewritten.IsValid()) {
+      pinned.insert(rewritten);
+    }
+  }
+  pinned_ = std::move(pinned);
+}
+
+void ValueCache::Insert(const Cell* cell) {
+  if (slots_.count(cell) != 0) {
+    return;
+  }
+  size_t slot = entries_.size();
+  if (!free_slots_.empty()) {
+    slot = free_slots_.back();
+    free_slots_.pop_back();
+    entries_[slot] = {cell, true};
+  } else {
+    entries_.push_back({cell, true});
+  }
+  slots_.emplace(cell, slot);
+  EvictOverBudget(cell);
+}
+
+void ValueCache::Touch(const Cell* cell) {
+  if (auto it = slots_.find(cell); it != slots_.end()) {
+    entries_[it->second].referenced = true;
+  }
+}
+
+void ValueCache::Remove(const Cell* cell) {
+  auto it = slots_.find(cell);
+  if (it == slots_.end()) {
+    return;
+  }
+  entries_[it->second] = {};
+  free_slots_.push_back(it->second);
+  slots_.erase(it);
+}
+
+void ValueCache::Hold(const Cell* cell) { ++held_[cell]; }
+
+void ValueCache::Release(const Cell* cell) {
+  auto it = held_.find(cell);
+  if (--it->second == 0) {
+    held_.erase(it);
+  }
+}
+
+void ValueCache::EvictOverBudget(const Cell* keep) {
+  // За два оборота стрелки снимаются все отметки; если и после этого
+  // вытеснять нечего, остались только закреплённые ячейки
+  size_t steps_left = 2 * entries_.size();
+  while (GetUsedBytes() > budget_bytes_ && steps_left-- > 0) {
+    hand_ = (hand_ + 1) % entries_.size();
+    Entry& entry = entries_[hand_];
+    if (entry.cell == nullptr || entry.cell == keep ||
+        held_.count(entry.cell) != 0 ||
+        pinned_.count(entry.cell->GetPosition()) != 0) {
+      continue;
+    }
+    if (entry.referenced) {
+      entry.referenced = false;
+      continue;
+    }
+    const Cell* cell = entry.cell;
+    Remove(cell);
+    cell->EvictValue();
+    ++evictions_;
+  }
+}
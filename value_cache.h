@@ -0,0 +1,60 @@
+#pragma once
+
+#include "common.h"
+
+#include <functional>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+class Cell;
+
+// Бюджет памяти для вычисленных значений формул. Значения, не помещающиеся
+// в бюджет, вытесняются по алгоритму CLOCK: чтение значения ставит ячейке
+// отметку, и стрелка, обходя ячейки по кругу, снимает отметки и вытесняет
+// первую ячейку без отметки. Закреплённые ячейки не вытесняются. Вытесненное
+// значение остаётся актуальным и вычисляется заново при следующем чтении.
+class ValueCache {
+ public:
+  explicit ValueCache(size_t budget_bytes);
+
+  size_t GetBudget() const;
+  void SetBudget(size_t budget_bytes);
+  // Память, занятая значениями ячеек под управлением кэша
+  size_t GetUsedBytes() const;
+  size_t GetEvictionCount() const;
+
+  void SetPinned(Position pos, bool pinned);
+  // Переносит закрепления при сдвиге ячеек; закрепления позиций, для
+  // которых rewrite вернул некорректную позицию, снимаются
+  void RewritePinned(const std::function<Position(Position)>& rewrite);
+
+  // Ячейка получила значение. Если бюджет превышен, вытесняет другие.
+  void Insert(const Cell* cell);
+  // Значение ячейки прочитано
+  void Touch(const Cell* cell);
+  // Ячейка удалена или сменила содержимое
+  void Remove(const Cell* cell);
+  // Удерживаемое значение не вытесняется, пока не снято столько же раз.
+  // Вычисление держит аргументы формулы до её вычисления, поэтому бюджет
+  // может быть временно превышен на их число.
+  void Hold(const Cell* cell);
+  void Release(const Cell* cell);
+
+ private:
+  struct Entry {
+    const Cell* cell = nullptr;
+    bool referenced = false;
+  };
+
+  void EvictOverBudget(const Cell* keep);
+
+  size_t budget_bytes_;
+  std::vector<Entry> entries_;
+  std::vector<size_t> free_slots_;
+  std::unordered_map<const Cell*, size_t> slots_;
+  size_t hand_ = 0;
+  std::set<Position> pinned_;
+  std::unordered_map<const Cell*, size_t> held_;
+  size_t evictions_ = 0;
+};
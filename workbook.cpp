@@ -0,0 +1,109 @@
+#include "workbook.h"
+
+#include <algorithm>
+#include <future>
+#include <set>
+#include <stdexcept>
+#include <thread>
+
+Sheet& Workbook::AddSheet(std::string name) {
+  if (!SheetPosition::IsValidSheetName(name)) {
+    throw std::invalid_argument("Invalid sheet name: " + name);
+  }
+  auto [it, inserted] = sheets_.emplace(std::move(name), nullptr);
+  if (!inserted) {
+    throw std::invalid_argument("Duplicate sheet name: " + it->first);
+  }
+  it->second = std::make_unique<Sheet>();
+  it->second->AttachWorkbook(this);
+  return *it->second;
+}
+
+Sheet* Workbook::GetSheet(std::string_view name) {
+  auto it = sheets_.find(name);
+  return it == sheets_.end() ? nullptr : it->second.get();
+}
+
+const Sheet* Workbook::GetSheet(std::string_view name) const {
+  auto it = sheets_.find(name);
+  return it == sheets_.end() ? nullptr : it->second.get();
+}
+
+std::vector<std::string> Workbook::GetSheetNames() const {
+  std::vector<std::string> result;
+  for (const auto& [name, sheet] : sheets_) {
+    result.push_back(name);
+  }
+  return result;
+}
+
+void Workbook::Recalculate(size_t threads) {
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  // Чтение закэшированного значения записывает замер в профиль листа и
+  // отметку в его кэш значений, а чтение вытесненного значения вычисляет
+  // его заново. Эти структуры не потокобезопасны.
+  bool shared_writes = std::any_of(
+      sheets_.begin(), sheets_.end(), [](const auto& entry) {
+        return entry.second->GetProfiler() || entry.second->GetValueCache();
+      });
+  if (shared_writes) {
+    threads = 1;
+  }
+
+  // Сколько ещё не вычисленных листов нужно каждому листу
+  std::map<const Sheet*, size_t> pending;
+  std::map<const Sheet*, std::vector<const Sheet*>> dependents;
+  std::vector<const Sheet*> ready;
+  for (const auto& [name, sheet] : sheets_) {
+    size_t count = 0;
+    for (const std::string& ref : sheet->GetReferencedSheets()) {
+      const Sheet* referenced = GetSheet(ref);
+      if (referenced && referenced != sheet.get()) {
+        dependents[referenced].push_back(sheet.get());
+        ++count;
+      }
+    }
+    pending[sheet.get()] = count;
+    if (count == 0) {
+      ready.push_back(sheet.get());
+    }
+  }
+
+  // Листы одного уровня читают только кэш уже вычисленных листов и
+  // изменяют только свои ячейки, поэтому вычисляются одновременно, если
+  // чтение кэша ничего не записывает
+  std::set<const Sheet*> done;
+  while (!ready.empty()) {
+    for (size_t begin = 0; begin < ready.size(); begin += threads) {
+      size_t end = std::min(ready.size(), begin + threads);
+      std::vector<std::future<void>> workers;
+      for (size_t i = begin + 1; i < end; ++i) {
+        workers.push_back(std::async(
+            std::launch::async, [sheet = ready[i]] { sheet->Recalculate(); }));
+      }
+      ready[begin]->Recalculate();
+      for (auto& worker : workers) {
+        worker.get();
+      }
+    }
+
+    std::vector<const Sheet*> next;
+    for (const Sheet* sheet : ready) {
+      done.insert(sheet);
+      for (const Sheet* dependent : dependents[sheet]) {
+        if (--pending[dependent] == 0) {
+          next.push_back(dependent);
+        }
+      }
+    }
+    ready = std::move(next);
+  }
+
+  for (const auto& [name, sheet] : sheets_) {
+    if (!done.count(sheet.get())) {
+      sheet->Recalculate();
+    }
+  }
+}
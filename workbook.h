@@ -0,0 +1,42 @@
+#pragma once
+
+#include "sheet.h"
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Книга из нескольких именованных листов. Формула листа может ссылаться на
+// ячейки других листов: =Sheet2!A1+B1. Граф зависимостей общий для всей
+// книги, поэтому правка ячейки одного листа сбрасывает кэш зависимых ячеек
+// других листов. Листы живут, пока жива книга.
+class Workbook {
+ public:
+  Workbook() = default;
+  Workbook(const Workbook&) = delete;
+  Workbook& operator=(const Workbook&) = delete;
+
+  // Добавляет пустой лист. Бросает std::invalid_argument, если имя
+  // некорректно или уже занято.
+  Sheet& AddSheet(std::string name);
+
+  // nullptr, если листа с таким именем нет
+  Sheet* GetSheet(std::string_view name);
+  const Sheet* GetSheet(std::string_view name) const;
+  std::vector<std::string> GetSheetNames() const;
+
+  // Вычисляет все ячейки книги. Листы, которые не ссылаются друг на друга
+  // ни прямо, ни через другие листы, вычисляются параллельно: сначала листы
+  // без ссылок на другие, затем ссылающиеся только на уже вычисленные.
+  // Листы с взаимными ссылками вычисляются последовательно в конце.
+  // threads == 0 - по числу аппаратных потоков. Если у какого-то листа
+  // включено профилирование или задан бюджет кэша значений, листы
+  // вычисляются последовательно: чтение значения меняет эти структуры.
+  void Recalculate(size_t threads = 0);
+
+ private:
+  std::map<std::string, std::unique_ptr<Sheet>, std::less<>> sheets_;
+};